@@ -42,6 +42,11 @@ struct box
         empty();
     }
 
+    bool is_empty() const
+    {
+        return m_min[0] > m_max[0] || m_min[1] > m_max[1] || m_min[2] > m_max[2];
+    }
+
     float largest_side() const
     {
         if(m_max[0] - m_min[0] > m_max[1] - m_min[1] &&
@@ -68,8 +73,16 @@ struct box
         extend(v[0], v[1], v[2]);
     }
 
+    // Extend by count points, each starting stride bytes after the last
+    void extend(const float *v, size_t stride, size_t count)
+    {
+        extend_bounds(v, stride, count, NULL, m_min, m_max);
+    }
+
     void extend(const box& b)
     {
+        if(b.is_empty())
+            return;
         extend(b.m_min);
         extend(b.m_max);
     }
@@ -85,13 +98,79 @@ struct box
     }
 };
 
+//
+// Bounds of the transformed box (Arvo, "Transforming Axis-Aligned Bounding
+// Boxes", Graphics Gems).  The center transforms as a point and each new
+// half-extent is the sum of the old half-extents weighted by the absolute
+// values of the corresponding column of the upper 3x3, which is exact for
+// all eight corners under any affine m.
+//
 inline box operator*(const box& b, const mat4f& m)
 {
     box newb;
-    newb.extend(b.m_min * m);
-    newb.extend(b.m_max * m);
+
+    if(b.is_empty())
+        return newb;
+
+    vec3f center = (b.m_min + b.m_max) * .5f;
+    vec3f extent = (b.m_max - b.m_min) * .5f;
+
+#if defined(VECTORMATH_VM4)
+
+    vm4 c = vm_madd(vm_set1(center[0]), vm_loadu(m.m_v + 0), vm_loadu(m.m_v + 12));
+    c = vm_madd(vm_set1(center[1]), vm_loadu(m.m_v + 4), c);
+    c = vm_madd(vm_set1(center[2]), vm_loadu(m.m_v + 8), c);
+
+    vm4 e = vm_mul(vm_set1(extent[0]), vm_abs(vm_loadu(m.m_v + 0)));
+    e = vm_madd(vm_set1(extent[1]), vm_abs(vm_loadu(m.m_v + 4)), e);
+    e = vm_madd(vm_set1(extent[2]), vm_abs(vm_loadu(m.m_v + 8)), e);
+
+    float lo[4], hi[4];
+    vm_storeu(lo, vm_sub(c, e));
+    vm_storeu(hi, vm_add(c, e));
+    newb.m_min.set(lo);
+    newb.m_max.set(hi);
+
+#else
+
+    vec3f newcenter = center * m;
+    for(int j = 0; j < 3; j++) {
+        float e = 0;
+        for(int i = 0; i < 3; i++)
+            e += fabsf(m[i * 4 + j]) * extent[i];
+        newb.m_min[j] = newcenter[j] - e;
+        newb.m_max[j] = newcenter[j] + e;
+    }
+
+#endif
+
     return newb;
 }
 
+// 1 if b is entirely on the side of plane its normal points to, -1 if
+// entirely on the other side, 0 if b straddles plane
+inline int box_plane_side(const box& b, const vec4f& plane)
+{
+    vec3f center = (b.m_min + b.m_max) * .5f;
+    vec3f extent = (b.m_max - b.m_min) * .5f;
+
+    float distance = plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3];
+    float radius = fabsf(plane[0]) * extent[0] + fabsf(plane[1]) * extent[1] + fabsf(plane[2]) * extent[2];
+
+    if(distance - radius >= 0)
+        return 1;
+    if(distance + radius < 0)
+        return -1;
+    return 0;
+}
+
+// Bounds of count points, each starting stride bytes after the last,
+// after transformation by m
+inline box transformed_bounds(const float *v, size_t stride, size_t count, const mat4f& m)
+{
+    box newb;
+    extend_bounds(v, stride, count, &m, newb.m_min, newb.m_max);
+    return newb;
+}
 
 #endif /* _GEOMETRY_H */
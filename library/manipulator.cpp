@@ -37,7 +37,7 @@ static void drag_to_rotation(float dx, float dy, rot4f *rotation)
     rotation->set(M_PI * dist, dy / dist, dx / dist, 0.0f);
 }
 
-static void calc_view_matrix(rot4f view_rotation, vec3f view_offset,
+static void calc_view_matrix(const quatf& view_rotation, vec3f view_offset,
     vec3f obj_center, vec3f obj_scale, mat4f *view_matrix)
 {
     *view_matrix = mat4f::translation(view_offset[0], view_offset[1], view_offset[2]);
@@ -82,12 +82,14 @@ void manipulator::move(float dx, float dy)
 		vec3f axis = m_worldX * world_rotation[1] + 
                     m_worldY * world_rotation[2];
 		local_rotation.set_axis(axis);
-		m_rotation = m_rotation * local_rotation;
+		m_rotation = m_rotation * quatf(local_rotation);
+		m_rotation.normalize();
 	    }
 	    break;
 
 	case ROLL:
-            m_rotation = m_rotation * rot4f(M_PI * 2 * -dy, 0, 0, 1);
+            m_rotation = m_rotation * quatf::axis_angle(M_PI * 2 * -dy, 0, 0, 1);
+            m_rotation.normalize();
 	    break;
 
 	case SCROLL:
@@ -122,7 +124,7 @@ manipulator::manipulator()
 
     m_translation.set(0, 0, 0);
 
-    m_rotation.set(0, 1, 0, 0);
+    m_rotation = quatf();
 
     calc_view_matrix(m_rotation, m_translation, m_center,
         m_scale, &m_matrix);
@@ -145,7 +147,7 @@ manipulator::manipulator(const box& bounds, float fov)
 
     m_translation.set(0, 0, -m_reference_size / cosf(fov));
 
-    m_rotation.set(0, 1, 0, 0);
+    m_rotation = quatf();
 
     calc_view_matrix(m_rotation, m_translation, m_center,
         m_scale, &m_matrix);
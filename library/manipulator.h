@@ -39,7 +39,7 @@ struct manipulator {
     float m_reference_size;	/* used to calculate translations */
     float m_motion_scale;		/* for dynamic scaling, etc */
 
-    rot4f m_rotation;		/* radians, x, y, z, like OpenGL */
+    quatf m_rotation;		/* unit quaternion */
     vec3f m_translation;
     vec3f m_scale;		/* scaled around center. */
     vec3f m_center;		/* ignore by setting to <0,0,0> */
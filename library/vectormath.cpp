@@ -15,6 +15,9 @@
 // 
 
 #include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
 #include "vectormath.h"
 
 mat4f mat4f::identity(
@@ -26,7 +29,160 @@ mat4f mat4f::identity(
 
 #define EPSILON .00001
 
+mat4f::kind mat4f::classify() const
+{
+    if(m_v[3] != 0 || m_v[7] != 0 || m_v[11] != 0 || m_v[15] != 1)
+        return GENERAL;
+
+    const float *r0 = m_v + 0, *r1 = m_v + 4, *r2 = m_v + 8;
+    float xx = r0[0] * r0[0] + r0[1] * r0[1] + r0[2] * r0[2];
+    float yy = r1[0] * r1[0] + r1[1] * r1[1] + r1[2] * r1[2];
+    float zz = r2[0] * r2[0] + r2[1] * r2[1] + r2[2] * r2[2];
+    float xy = r0[0] * r1[0] + r0[1] * r1[1] + r0[2] * r1[2];
+    float yz = r1[0] * r2[0] + r1[1] * r2[1] + r1[2] * r2[2];
+    float zx = r2[0] * r0[0] + r2[1] * r0[1] + r2[2] * r0[2];
+
+    float tolerance = EPSILON * xx;
+    if(xx < EPSILON ||
+        fabs(xy) > tolerance || fabs(yz) > tolerance || fabs(zx) > tolerance ||
+        fabs(yy - xx) > tolerance || fabs(zz - xx) > tolerance)
+        return AFFINE;
+
+    if(fabs(xx - 1) < EPSILON)
+        return RIGID;
+
+    return UNIFORM_SCALE;
+}
+
 bool mat4f::invert(const mat4f& mat, bool singular_fail)
+{
+    switch(mat.classify()) {
+        case RIGID:
+            invert_rigid(mat);
+            return true;
+
+        case UNIFORM_SCALE:
+            return invert_uniform_scale(mat, singular_fail);
+
+        case AFFINE:
+            return invert_affine(mat, singular_fail);
+
+        default:
+            return invert_general(mat, singular_fail);
+    }
+}
+
+// [A 0; t 1]^-1 is [A^-1 0; -t A^-1 1], so every affine path below only
+// needs the inverse of the upper 3x3 and then transforms the translation.
+static void set_affine_inverse(mat4f& out, const float a[9], const float *t)
+{
+    out = mat4f(
+        a[0], a[1], a[2], 0,
+        a[3], a[4], a[5], 0,
+        a[6], a[7], a[8], 0,
+        -(t[0] * a[0] + t[1] * a[3] + t[2] * a[6]),
+        -(t[0] * a[1] + t[1] * a[4] + t[2] * a[7]),
+        -(t[0] * a[2] + t[1] * a[5] + t[2] * a[8]),
+        1);
+}
+
+void mat4f::invert_rigid(const mat4f& mat)
+{
+    // Orthonormal, so the inverse of the 3x3 is its transpose
+    float a[9] = {
+        mat[0], mat[4], mat[8],
+        mat[1], mat[5], mat[9],
+        mat[2], mat[6], mat[10],
+    };
+    set_affine_inverse(*this, a, mat.m_v + 12);
+}
+
+bool mat4f::invert_uniform_scale(const mat4f& mat, bool singular_fail)
+{
+    // Orthogonal with rows of length s, so the inverse is the transpose / s^2
+    float ss = mat[0] * mat[0] + mat[1] * mat[1] + mat[2] * mat[2];
+    if(singular_fail && ss < EPSILON)
+        return false;
+
+    float r = 1.0f / ss;
+    float a[9] = {
+        mat[0] * r, mat[4] * r, mat[8] * r,
+        mat[1] * r, mat[5] * r, mat[9] * r,
+        mat[2] * r, mat[6] * r, mat[10] * r,
+    };
+    set_affine_inverse(*this, a, mat.m_v + 12);
+    return true;
+}
+
+// Cofactors of the upper 3x3 of m (the rows are r1 x r2, r2 x r0 and
+// r0 x r1) and its determinant.  The inverse of the 3x3 is the transpose
+// of the cofactors divided by the determinant.
+static float cofactors3x3(const mat4f& m, float c[9])
+{
+    c[0] = m[5] * m[10] - m[6] * m[9];
+    c[1] = m[6] * m[8] - m[4] * m[10];
+    c[2] = m[4] * m[9] - m[5] * m[8];
+
+    c[3] = m[9] * m[2] - m[10] * m[1];
+    c[4] = m[10] * m[0] - m[8] * m[2];
+    c[5] = m[8] * m[1] - m[9] * m[0];
+
+    c[6] = m[1] * m[6] - m[2] * m[5];
+    c[7] = m[2] * m[4] - m[0] * m[6];
+    c[8] = m[0] * m[5] - m[1] * m[4];
+
+    return m[0] * c[0] + m[1] * c[1] + m[2] * c[2];
+}
+
+bool mat4f::invert_affine(const mat4f& mat, bool singular_fail)
+{
+    float c[9];
+    float det = cofactors3x3(mat, c);
+    if(singular_fail && (fabs(det) < EPSILON))
+        return false;
+
+    float r = 1.0f / det;
+    float a[9] = {
+        c[0] * r, c[3] * r, c[6] * r,
+        c[1] * r, c[4] * r, c[7] * r,
+        c[2] * r, c[5] * r, c[8] * r,
+    };
+    set_affine_inverse(*this, a, mat.m_v + 12);
+    return true;
+}
+
+mat4f mat4f::normal_matrix() const
+{
+    switch(classify()) {
+        case RIGID:
+            return mat4f(
+                m_v[0], m_v[1], m_v[2], 0,
+                m_v[4], m_v[5], m_v[6], 0,
+                m_v[8], m_v[9], m_v[10], 0,
+                0, 0, 0, 1);
+
+        case UNIFORM_SCALE: {
+            float r = 1.0f / (m_v[0] * m_v[0] + m_v[1] * m_v[1] + m_v[2] * m_v[2]);
+            return mat4f(
+                m_v[0] * r, m_v[1] * r, m_v[2] * r, 0,
+                m_v[4] * r, m_v[5] * r, m_v[6] * r, 0,
+                m_v[8] * r, m_v[9] * r, m_v[10] * r, 0,
+                0, 0, 0, 1);
+        }
+
+        default: {
+            float c[9];
+            float r = 1.0f / cofactors3x3(*this, c);
+            return mat4f(
+                c[0] * r, c[1] * r, c[2] * r, 0,
+                c[3] * r, c[4] * r, c[5] * r, 0,
+                c[6] * r, c[7] * r, c[8] * r, 0,
+                0, 0, 0, 1);
+        }
+    }
+}
+
+bool mat4f::invert_general(const mat4f& mat, bool singular_fail)
 {
     int		i, rswap;
     float	det, div, swap;
@@ -248,29 +404,65 @@ void mat4f::calc_rot4f(rot4f *rotation) const
 
 rot4f &rot4f::mult(const rot4f &rotation1, const rot4f &rotation2)
 {
-    mat4f matrix1(rotation1);
-    mat4f matrix2(rotation2);
-    mat4f matrix3;
-    float dist;
-
-    matrix3 = matrix1 * matrix2;
-    matrix3.calc_rot4f(this);
-
-    dist = (float)sqrt(m_v[1] * m_v[1] + m_v[2] * m_v[2] +
-        m_v[3] * m_v[3]);
+    quatf q = quatf(rotation1) * quatf(rotation2);
+    q.normalize();
+    q.calc_rot4f(this);
 
 #if defined(DEBUG)
     if(m_v[0] != m_v[0]) /* isNAN */
 	abort();
 #endif // DEBUG
 
-    m_v[1] /= dist;
-    m_v[2] /= dist;
-    m_v[3] /= dist;
-
     return *this;
 }
 
+void quatf::calc_rot4f(rot4f *rotation) const
+{
+    float w = m_v[3];
+    if(w > 1.0f)
+        w = 1.0f;
+    if(w < -1.0f)
+        w = -1.0f;
+
+    float s = sqrtf(m_v[0] * m_v[0] + m_v[1] * m_v[1] + m_v[2] * m_v[2]);
+    if(s < EPSILON) {
+        /* no rotation; axis is arbitrary */
+        rotation->set(0.0f, 1.0f, 0.0f, 0.0f);
+        return;
+    }
+
+    rotation->set(2.0f * acosf(w), m_v[0] / s, m_v[1] / s, m_v[2] / s);
+}
+
+quatf quat_slerp(const quatf& q1, const quatf& q2, float a)
+{
+    float cosine = vec_dot(q1, q2);
+    float sign = 1.0f;
+
+    /* q and -q are the same rotation; take the shorter path */
+    if(cosine < 0.0f) {
+        cosine = -cosine;
+        sign = -1.0f;
+    }
+
+    float w1, w2;
+    if(cosine > 1.0f - EPSILON) {
+        /* nearly parallel; lerp avoids dividing by sin(~0) */
+        w1 = 1.0f - a;
+        w2 = a;
+    } else {
+        float angle = acosf(cosine);
+        float sine = sinf(angle);
+        w1 = sinf((1.0f - a) * angle) / sine;
+        w2 = sinf(a * angle) / sine;
+    }
+
+    quatf q;
+    for(int i = 0; i < 4; i++)
+        q[i] = q1[i] * w1 + q2[i] * w2 * sign;
+    return q.normalize();
+}
+
 rot4f operator*(const rot4f& r1, const rot4f& r2)
 {
     rot4f t;
@@ -279,6 +471,276 @@ rot4f operator*(const rot4f& r1, const rot4f& r2)
     return t;
 }
 
+// Batch transforms.  Points are gathered four at a time into x, y and z
+// registers so each output component is three multiply-adds for four
+// points; the tail and non-SIMD builds use the scalar loop.
+
+static inline const float *strided(const float *base, size_t stride, size_t i)
+{
+    return (const float *)((const unsigned char *)base + stride * i);
+}
+
+static inline float *strided(float *base, size_t stride, size_t i)
+{
+    return (float *)((unsigned char *)base + stride * i);
+}
+
+template <bool point>
+static void transform_aos(const mat4f& m, const float *in, size_t in_stride,
+    float *out, size_t out_stride, size_t count)
+{
+    size_t i = 0;
+
+#if defined(VECTORMATH_VM4)
+    vm4 m0 = vm_set1(m[0]), m1 = vm_set1(m[1]), m2 = vm_set1(m[2]);
+    vm4 m4 = vm_set1(m[4]), m5 = vm_set1(m[5]), m6 = vm_set1(m[6]);
+    vm4 m8 = vm_set1(m[8]), m9 = vm_set1(m[9]), m10 = vm_set1(m[10]);
+    vm4 m12 = vm_set1(point ? m[12] : 0), m13 = vm_set1(point ? m[13] : 0), m14 = vm_set1(point ? m[14] : 0);
+
+    for(; i + 4 <= count; i += 4) {
+        const float *p0 = strided(in, in_stride, i + 0);
+        const float *p1 = strided(in, in_stride, i + 1);
+        const float *p2 = strided(in, in_stride, i + 2);
+        const float *p3 = strided(in, in_stride, i + 3);
+
+        vm4 x = vm_setr(p0[0], p1[0], p2[0], p3[0]);
+        vm4 y = vm_setr(p0[1], p1[1], p2[1], p3[1]);
+        vm4 z = vm_setr(p0[2], p1[2], p2[2], p3[2]);
+
+        float ox[4], oy[4], oz[4];
+        vm_storeu(ox, vm_madd(z, m8, vm_madd(y, m4, vm_madd(x, m0, m12))));
+        vm_storeu(oy, vm_madd(z, m9, vm_madd(y, m5, vm_madd(x, m1, m13))));
+        vm_storeu(oz, vm_madd(z, m10, vm_madd(y, m6, vm_madd(x, m2, m14))));
+
+        for(int j = 0; j < 4; j++) {
+            float *o = strided(out, out_stride, i + j);
+            o[0] = ox[j];
+            o[1] = oy[j];
+            o[2] = oz[j];
+        }
+    }
+#endif
+
+    for(; i < count; i++) {
+        const float *p = strided(in, in_stride, i);
+        float x = p[0], y = p[1], z = p[2];
+        float *o = strided(out, out_stride, i);
+        o[0] = x * m[0] + y * m[4] + z * m[8] + (point ? m[12] : 0);
+        o[1] = x * m[1] + y * m[5] + z * m[9] + (point ? m[13] : 0);
+        o[2] = x * m[2] + y * m[6] + z * m[10] + (point ? m[14] : 0);
+    }
+}
+
+template <bool point>
+static void transform_soa(const mat4f& m, const float *x, const float *y, const float *z,
+    float *out_x, float *out_y, float *out_z, size_t count)
+{
+    size_t i = 0;
+
+#if defined(VECTORMATH_VM4)
+    vm4 m0 = vm_set1(m[0]), m1 = vm_set1(m[1]), m2 = vm_set1(m[2]);
+    vm4 m4 = vm_set1(m[4]), m5 = vm_set1(m[5]), m6 = vm_set1(m[6]);
+    vm4 m8 = vm_set1(m[8]), m9 = vm_set1(m[9]), m10 = vm_set1(m[10]);
+    vm4 m12 = vm_set1(point ? m[12] : 0), m13 = vm_set1(point ? m[13] : 0), m14 = vm_set1(point ? m[14] : 0);
+
+    for(; i + 4 <= count; i += 4) {
+        vm4 vx = vm_loadu(x + i);
+        vm4 vy = vm_loadu(y + i);
+        vm4 vz = vm_loadu(z + i);
+        vm_storeu(out_x + i, vm_madd(vz, m8, vm_madd(vy, m4, vm_madd(vx, m0, m12))));
+        vm_storeu(out_y + i, vm_madd(vz, m9, vm_madd(vy, m5, vm_madd(vx, m1, m13))));
+        vm_storeu(out_z + i, vm_madd(vz, m10, vm_madd(vy, m6, vm_madd(vx, m2, m14))));
+    }
+#endif
+
+    for(; i < count; i++) {
+        float vx = x[i], vy = y[i], vz = z[i];
+        out_x[i] = vx * m[0] + vy * m[4] + vz * m[8] + (point ? m[12] : 0);
+        out_y[i] = vx * m[1] + vy * m[5] + vz * m[9] + (point ? m[13] : 0);
+        out_z[i] = vx * m[2] + vy * m[6] + vz * m[10] + (point ? m[14] : 0);
+    }
+}
+
+void transform_points(const mat4f& m, const float *in, size_t in_stride,
+    float *out, size_t out_stride, size_t count)
+{
+    transform_aos<true>(m, in, in_stride, out, out_stride, count);
+}
+
+void transform_directions(const mat4f& m, const float *in, size_t in_stride,
+    float *out, size_t out_stride, size_t count)
+{
+    transform_aos<false>(m, in, in_stride, out, out_stride, count);
+}
+
+void transform_points_soa(const mat4f& m, const float *x, const float *y, const float *z,
+    float *out_x, float *out_y, float *out_z, size_t count)
+{
+    transform_soa<true>(m, x, y, z, out_x, out_y, out_z, count);
+}
+
+void transform_directions_soa(const mat4f& m, const float *x, const float *y, const float *z,
+    float *out_x, float *out_y, float *out_z, size_t count)
+{
+    transform_soa<false>(m, x, y, z, out_x, out_y, out_z, count);
+}
+
+void extend_bounds(const float *in, size_t stride, size_t count, const mat4f *m,
+    vec3f& boxmin, vec3f& boxmax)
+{
+    const mat4f& t = m ? *m : mat4f::identity;
+    size_t i = 0;
+
+#if defined(VECTORMATH_VM4)
+    if(count >= 4) {
+        vm4 m0 = vm_set1(t[0]), m1 = vm_set1(t[1]), m2 = vm_set1(t[2]);
+        vm4 m4 = vm_set1(t[4]), m5 = vm_set1(t[5]), m6 = vm_set1(t[6]);
+        vm4 m8 = vm_set1(t[8]), m9 = vm_set1(t[9]), m10 = vm_set1(t[10]);
+        vm4 m12 = vm_set1(t[12]), m13 = vm_set1(t[13]), m14 = vm_set1(t[14]);
+
+        vm4 minx = vm_set1(boxmin[0]), miny = vm_set1(boxmin[1]), minz = vm_set1(boxmin[2]);
+        vm4 maxx = vm_set1(boxmax[0]), maxy = vm_set1(boxmax[1]), maxz = vm_set1(boxmax[2]);
+
+        for(; i + 4 <= count; i += 4) {
+            const float *p0 = strided(in, stride, i + 0);
+            const float *p1 = strided(in, stride, i + 1);
+            const float *p2 = strided(in, stride, i + 2);
+            const float *p3 = strided(in, stride, i + 3);
+
+            vm4 x = vm_setr(p0[0], p1[0], p2[0], p3[0]);
+            vm4 y = vm_setr(p0[1], p1[1], p2[1], p3[1]);
+            vm4 z = vm_setr(p0[2], p1[2], p2[2], p3[2]);
+
+            if(m) {
+                vm4 tx = vm_madd(z, m8, vm_madd(y, m4, vm_madd(x, m0, m12)));
+                vm4 ty = vm_madd(z, m9, vm_madd(y, m5, vm_madd(x, m1, m13)));
+                vm4 tz = vm_madd(z, m10, vm_madd(y, m6, vm_madd(x, m2, m14)));
+                x = tx;
+                y = ty;
+                z = tz;
+            }
+
+            minx = vm_min(minx, x); maxx = vm_max(maxx, x);
+            miny = vm_min(miny, y); maxy = vm_max(maxy, y);
+            minz = vm_min(minz, z); maxz = vm_max(maxz, z);
+        }
+
+        float lo[3][4], hi[3][4];
+        vm_storeu(lo[0], minx); vm_storeu(lo[1], miny); vm_storeu(lo[2], minz);
+        vm_storeu(hi[0], maxx); vm_storeu(hi[1], maxy); vm_storeu(hi[2], maxz);
+        for(int c = 0; c < 3; c++)
+            for(int j = 0; j < 4; j++) {
+                boxmin[c] = std::min(boxmin[c], lo[c][j]);
+                boxmax[c] = std::max(boxmax[c], hi[c][j]);
+            }
+    }
+#endif
+
+    for(; i < count; i++) {
+        const float *p = strided(in, stride, i);
+        vec3f v(p[0], p[1], p[2]);
+        if(m)
+            v = v * t;
+        for(int c = 0; c < 3; c++) {
+            boxmin[c] = std::min(boxmin[c], v[c]);
+            boxmax[c] = std::max(boxmax[c], v[c]);
+        }
+    }
+}
+
+vec2f oct_encode(const vec3f& n)
+{
+    float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    if(l1 == 0)
+        return vec2f(0, 0);
+
+    float x = n[0] / l1;
+    float y = n[1] / l1;
+    if(n[2] < 0) {
+        // Fold the lower hemisphere over the diagonals
+        float fx = (1 - fabsf(y)) * (x >= 0 ? 1 : -1);
+        float fy = (1 - fabsf(x)) * (y >= 0 ? 1 : -1);
+        x = fx;
+        y = fy;
+    }
+    return vec2f(x, y);
+}
+
+vec3f oct_decode(const vec2f& e)
+{
+    vec3f n(e[0], e[1], 1 - fabsf(e[0]) - fabsf(e[1]));
+    if(n[2] < 0) {
+        float x = (1 - fabsf(n[1])) * (n[0] >= 0 ? 1 : -1);
+        float y = (1 - fabsf(n[0])) * (n[1] >= 0 ? 1 : -1);
+        n[0] = x;
+        n[1] = y;
+    }
+    return vec_normalize(n);
+}
+
+unsigned short float_to_half(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if(((bits >> 23) & 0xff) == 0xff) // inf or NaN
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    if(exponent >= 31) // overflow to inf
+        return sign | 0x7c00;
+
+    if(exponent <= 0) {
+        // Subnormal half, or zero
+        if(exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t midpoint = 1u << (shift - 1);
+        if(rest > midpoint || (rest == midpoint && (half & 1)))
+            half++;
+        return sign | half;
+    }
+
+    uint32_t half = (exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    if(rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++; // may carry into the exponent, which is still correct
+    return sign | half;
+}
+
+float half_to_float(unsigned short h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    int exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+
+    if(exponent == 0x1f)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else if(exponent != 0)
+        bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    else if(mantissa == 0)
+        bits = sign;
+    else {
+        // Renormalize a subnormal half
+        exponent = 1;
+        while(!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | ((exponent - 15 + 127) << 23) | ((mantissa & 0x3ff) << 13);
+    }
+
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
 #ifdef TEST
 
 #include <stdio.h>
@@ -20,6 +20,66 @@
 
 #include <cmath>
 #include <cstdio>
+#include <cstddef>
+
+// Pick a SIMD implementation for the mat4f and vec4f products at compile
+// time.  Define VECTORMATH_NO_SIMD to force the scalar reference code.
+#if !defined(VECTORMATH_NO_SIMD)
+#if defined(__AVX__)
+#define VECTORMATH_AVX 1
+#define VECTORMATH_SSE 1
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define VECTORMATH_SSE 1
+#include <xmmintrin.h>
+#if defined(__FMA__)
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define VECTORMATH_NEON 1
+#include <arm_neon.h>
+#endif
+#endif /* !VECTORMATH_NO_SIMD */
+
+// vm4 is four floats in one SIMD register, used by the batch routines to
+// process four points or boxes at a time.
+#if defined(VECTORMATH_SSE)
+#define VECTORMATH_VM4 1
+typedef __m128 vm4;
+inline vm4 vm_set1(float f) { return _mm_set1_ps(f); }
+inline vm4 vm_setr(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+inline vm4 vm_loadu(const float *p) { return _mm_loadu_ps(p); }
+inline void vm_storeu(float *p, vm4 v) { _mm_storeu_ps(p, v); }
+inline vm4 vm_add(vm4 a, vm4 b) { return _mm_add_ps(a, b); }
+inline vm4 vm_sub(vm4 a, vm4 b) { return _mm_sub_ps(a, b); }
+inline vm4 vm_mul(vm4 a, vm4 b) { return _mm_mul_ps(a, b); }
+inline vm4 vm_min(vm4 a, vm4 b) { return _mm_min_ps(a, b); }
+inline vm4 vm_max(vm4 a, vm4 b) { return _mm_max_ps(a, b); }
+inline vm4 vm_abs(vm4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+// a * b + c, fused when the target has FMA
+inline vm4 vm_madd(vm4 a, vm4 b, vm4 c)
+{
+#if defined(__FMA__)
+    return _mm_fmadd_ps(a, b, c);
+#else
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+}
+#elif defined(VECTORMATH_NEON)
+#define VECTORMATH_VM4 1
+typedef float32x4_t vm4;
+inline vm4 vm_set1(float f) { return vdupq_n_f32(f); }
+inline vm4 vm_setr(float a, float b, float c, float d) { float t[4] = {a, b, c, d}; return vld1q_f32(t); }
+inline vm4 vm_loadu(const float *p) { return vld1q_f32(p); }
+inline void vm_storeu(float *p, vm4 v) { vst1q_f32(p, v); }
+inline vm4 vm_add(vm4 a, vm4 b) { return vaddq_f32(a, b); }
+inline vm4 vm_sub(vm4 a, vm4 b) { return vsubq_f32(a, b); }
+inline vm4 vm_mul(vm4 a, vm4 b) { return vmulq_f32(a, b); }
+inline vm4 vm_min(vm4 a, vm4 b) { return vminq_f32(a, b); }
+inline vm4 vm_max(vm4 a, vm4 b) { return vmaxq_f32(a, b); }
+inline vm4 vm_abs(vm4 a) { return vabsq_f32(a); }
+inline vm4 vm_madd(vm4 a, vm4 b, vm4 c) { return vmlaq_f32(c, a, b); }
+#endif
 
 template <class V>
 inline float vec_dot(const V& v0, const V& v1)
@@ -357,7 +417,8 @@ inline vec3f vec_cross(const vec3f& v0, const vec3f& v1)
     return tmp;
 }
 
-struct vec4f
+// Aligned so the SIMD paths can use aligned loads and stores
+struct alignas(16) vec4f
 {
     float m_v[4];
     inline static int dimension() { return 4; }
@@ -487,8 +548,74 @@ struct rot4f : public vec4f
 
 rot4f operator*(const rot4f& r1, const rot4f& r2);
 
+//
+// Unit quaternion rotation stored as <x, y, z, w>.  Composition follows
+// mat4f: q1 * q2 rotates by q1 and then by q2, so mat4f(q1 * q2) equals
+// mat4f(q1) * mat4f(q2).
+//
+struct quatf : public vec4f
+{
+    quatf() :
+        vec4f(0.0f, 0.0f, 0.0f, 1.0f)
+    {
+    }
+    quatf(float x, float y, float z, float w) :
+        vec4f(x, y, z, w)
+    {
+    }
+
+    // From an angle in radians around an axis, like rot4f and OpenGL
+    static inline quatf axis_angle(float angle, float x, float y, float z)
+    {
+        float len = sqrtf(x * x + y * y + z * z);
+        if(len == 0.0f)
+            return quatf();
+        float s = sinf(angle * 0.5f) / len;
+        return quatf(x * s, y * s, z * s, cosf(angle * 0.5f));
+    }
+
+    explicit quatf(const rot4f& r) :
+        vec4f(axis_angle(r[0], r[1], r[2], r[3]))
+    {
+    }
+
+    inline quatf& normalize() {
+        float len = length();
+        if(len > 0.0f)
+            *this *= 1.0f / len;
+        return *this;
+    }
 
-struct mat4f
+    inline quatf conjugate() const {
+        return quatf(-m_v[0], -m_v[1], -m_v[2], m_v[3]);
+    }
+
+    void calc_rot4f(rot4f *out) const;
+
+    // Hamilton product q2 q1
+    inline quatf& mult(const quatf& q1, const quatf& q2) {
+        float x = q2[3] * q1[0] + q2[0] * q1[3] + q2[1] * q1[2] - q2[2] * q1[1];
+        float y = q2[3] * q1[1] - q2[0] * q1[2] + q2[1] * q1[3] + q2[2] * q1[0];
+        float z = q2[3] * q1[2] + q2[0] * q1[1] - q2[1] * q1[0] + q2[2] * q1[3];
+        float w = q2[3] * q1[3] - q2[0] * q1[0] - q2[1] * q1[1] - q2[2] * q1[2];
+        set(x, y, z, w);
+        return *this;
+    }
+};
+
+inline quatf operator*(const quatf& q1, const quatf& q2)
+{
+    quatf t;
+    t.mult(q1, q2);
+    return t;
+}
+
+// Spherical interpolation from q1 (a = 0) to q2 (a = 1) along the shorter arc
+quatf quat_slerp(const quatf& q1, const quatf& q2, float a);
+
+
+// Rows are 16-byte aligned so the SIMD paths can load them directly
+struct alignas(16) mat4f
 {
     float m_v[16];
     inline static int dimension() { return 16; }
@@ -554,8 +681,30 @@ struct mat4f
 	    (m_v[8] * m_v[13] - m_v[9] * m_v[12]);
     }
 
+    // Structure of a matrix as far as inversion is concerned.  All but
+    // GENERAL have last column <0, 0, 0, 1>; UNIFORM_SCALE and RIGID
+    // additionally have an upper 3x3 that is orthogonal with equal row
+    // lengths, of length 1 for RIGID.
+    enum kind {
+        GENERAL,
+        AFFINE,
+        UNIFORM_SCALE,
+        RIGID
+    };
+    kind classify() const;
+
+    // invert() classifies the input and uses the cheapest exact path;
+    // the specific paths assume the classification holds.
     bool invert(const mat4f& in, bool singular_fail = true);
     bool invert() { return invert(*this); }
+    bool invert_general(const mat4f& in, bool singular_fail = true);
+    bool invert_affine(const mat4f& in, bool singular_fail = true);
+    bool invert_uniform_scale(const mat4f& in, bool singular_fail = true);
+    void invert_rigid(const mat4f& in);
+
+    // Inverse transpose of the upper 3x3 in a 4x4 with no translation,
+    // suitable for transforming normals
+    mat4f normal_matrix() const;
 
     static inline mat4f translation(float x, float y, float z) {
 	mat4f m(identity);
@@ -630,23 +779,32 @@ struct mat4f
 	(*this) = rotation(r[0], r[1], r[2], r[3]);
     }
 
-    void calc_rot4f(rot4f *out) const;
+    // q must be unit length
+    inline mat4f(const quatf& q) {
+	float x = q[0], y = q[1], z = q[2], w = q[3];
 
-    inline mat4f& mult(mat4f& m1, mat4f &m2) {
-	mat4f t;
-	int i, j;
+	m_v[0] = 1 - 2 * (y * y + z * z);
+	m_v[1] = 2 * (x * y + w * z);
+	m_v[2] = 2 * (x * z - w * y);
+	m_v[3] = 0;
 
-	for(j = 0; j < 4; j++)
-	    for(i = 0; i < 4; i++)
-	       t[i * 4 + j] = m1[i * 4 + 0] * m2[0 * 4 + j] +
-		   m1[i * 4 + 1] * m2[1 * 4 + j] +
-		   m1[i * 4 + 2] * m2[2 * 4 + j] +
-		   m1[i * 4 + 3] * m2[3 * 4 + j];
+	m_v[4] = 2 * (x * y - w * z);
+	m_v[5] = 1 - 2 * (x * x + z * z);
+	m_v[6] = 2 * (y * z + w * x);
+	m_v[7] = 0;
 
-	*this = t;
-	return *this;
+	m_v[8] = 2 * (x * z + w * y);
+	m_v[9] = 2 * (y * z - w * x);
+	m_v[10] = 1 - 2 * (x * x + y * y);
+	m_v[11] = 0;
+
+	m_v[12] = 0; m_v[13] = 0; m_v[14] = 0; m_v[15] = 1;
     }
 
+    void calc_rot4f(rot4f *out) const;
+
+    inline mat4f& mult(const mat4f& m1, const mat4f &m2);
+
     inline mat4f(const float *v) {
 	for(int i = 0; i < 16; i++) m_v[i] = v[i];
     }
@@ -680,7 +838,10 @@ struct mat4f
 	{ for(int i = 0; i < 16; i++) v[i] = m_v[i]; }
 };
 
-inline mat4f operator*(const mat4f& m1, const mat4f& m2)
+// Scalar reference implementations of the products below.  The
+// operators use these directly when no SIMD path is compiled in, and the
+// tests compare the SIMD results against them.
+inline mat4f mat4f_mult_scalar(const mat4f& m1, const mat4f& m2)
 {
     mat4f t;
     int i, j;
@@ -696,7 +857,7 @@ inline mat4f operator*(const mat4f& m1, const mat4f& m2)
     return t;
 }
 
-inline vec4f operator*(const vec4f& in, const mat4f& m)
+inline vec4f vec4f_mult_scalar(const vec4f& in, const mat4f& m)
 {
     int i;
     vec4f t;
@@ -710,7 +871,7 @@ inline vec4f operator*(const vec4f& in, const mat4f& m)
     return t;
 }
 
-inline vec3f operator*(const vec3f& in, const mat4f& m)
+inline vec3f vec3f_mult_scalar(const vec3f& in, const mat4f& m)
 {
     int i;
     vec4f t;
@@ -724,6 +885,184 @@ inline vec3f operator*(const vec3f& in, const mat4f& m)
     return vec3f(t.m_v);
 }
 
+// Row i of m1 * m2 is the sum of the rows of m2 weighted by the elements
+// of row i of m1, so each output row is four broadcast multiply-adds.
+inline mat4f operator*(const mat4f& m1, const mat4f& m2)
+{
+#if defined(VECTORMATH_AVX)
+
+    // Two output rows per iteration; each 128-bit lane holds one row.
+    mat4f t;
+    __m256 r0 = _mm256_broadcast_ps((const __m128*)(m2.m_v + 0));
+    __m256 r1 = _mm256_broadcast_ps((const __m128*)(m2.m_v + 4));
+    __m256 r2 = _mm256_broadcast_ps((const __m128*)(m2.m_v + 8));
+    __m256 r3 = _mm256_broadcast_ps((const __m128*)(m2.m_v + 12));
+
+    for(int i = 0; i < 16; i += 8) {
+	__m256 a = _mm256_loadu_ps(m1.m_v + i);
+	__m256 row = _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0x00), r0);
+	row = _mm256_add_ps(row, _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0x55), r1));
+	row = _mm256_add_ps(row, _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0xAA), r2));
+	row = _mm256_add_ps(row, _mm256_mul_ps(_mm256_shuffle_ps(a, a, 0xFF), r3));
+	_mm256_storeu_ps(t.m_v + i, row);
+    }
+    return t;
+
+#elif defined(VECTORMATH_SSE)
+
+    mat4f t;
+    __m128 r0 = _mm_load_ps(m2.m_v + 0);
+    __m128 r1 = _mm_load_ps(m2.m_v + 4);
+    __m128 r2 = _mm_load_ps(m2.m_v + 8);
+    __m128 r3 = _mm_load_ps(m2.m_v + 12);
+
+    for(int i = 0; i < 16; i += 4) {
+	__m128 row = _mm_mul_ps(_mm_set1_ps(m1.m_v[i + 0]), r0);
+	row = vm_madd(_mm_set1_ps(m1.m_v[i + 1]), r1, row);
+	row = vm_madd(_mm_set1_ps(m1.m_v[i + 2]), r2, row);
+	row = vm_madd(_mm_set1_ps(m1.m_v[i + 3]), r3, row);
+	_mm_store_ps(t.m_v + i, row);
+    }
+    return t;
+
+#elif defined(VECTORMATH_NEON)
+
+    mat4f t;
+    float32x4_t r0 = vld1q_f32(m2.m_v + 0);
+    float32x4_t r1 = vld1q_f32(m2.m_v + 4);
+    float32x4_t r2 = vld1q_f32(m2.m_v + 8);
+    float32x4_t r3 = vld1q_f32(m2.m_v + 12);
+
+    for(int i = 0; i < 16; i += 4) {
+	float32x4_t row = vmulq_n_f32(r0, m1.m_v[i + 0]);
+	row = vmlaq_n_f32(row, r1, m1.m_v[i + 1]);
+	row = vmlaq_n_f32(row, r2, m1.m_v[i + 2]);
+	row = vmlaq_n_f32(row, r3, m1.m_v[i + 3]);
+	vst1q_f32(t.m_v + i, row);
+    }
+    return t;
+
+#else
+
+    return mat4f_mult_scalar(m1, m2);
+
+#endif
+}
+
+inline mat4f& mat4f::mult(const mat4f& m1, const mat4f &m2)
+{
+    *this = m1 * m2;
+    return *this;
+}
+
+inline vec4f operator*(const vec4f& in, const mat4f& m)
+{
+#if defined(VECTORMATH_SSE)
+
+    vec4f t;
+    __m128 v = _mm_load_ps(in.m_v);
+    __m128 r = _mm_mul_ps(_mm_shuffle_ps(v, v, 0x00), _mm_load_ps(m.m_v + 0));
+    r = vm_madd(_mm_shuffle_ps(v, v, 0x55), _mm_load_ps(m.m_v + 4), r);
+    r = vm_madd(_mm_shuffle_ps(v, v, 0xAA), _mm_load_ps(m.m_v + 8), r);
+    r = vm_madd(_mm_shuffle_ps(v, v, 0xFF), _mm_load_ps(m.m_v + 12), r);
+    _mm_store_ps(t.m_v, r);
+    return t;
+
+#elif defined(VECTORMATH_NEON)
+
+    vec4f t;
+    float32x4_t r = vmulq_n_f32(vld1q_f32(m.m_v + 0), in[0]);
+    r = vmlaq_n_f32(r, vld1q_f32(m.m_v + 4), in[1]);
+    r = vmlaq_n_f32(r, vld1q_f32(m.m_v + 8), in[2]);
+    r = vmlaq_n_f32(r, vld1q_f32(m.m_v + 12), in[3]);
+    vst1q_f32(t.m_v, r);
+    return t;
+
+#else
+
+    return vec4f_mult_scalar(in, m);
+
+#endif
+}
+
+// Treats in as a point (w = 1) and drops the resulting w without dividing.
+inline vec3f operator*(const vec3f& in, const mat4f& m)
+{
+#if defined(VECTORMATH_SSE)
+
+    vec4f t;
+    __m128 r = vm_madd(_mm_set1_ps(in[0]), _mm_load_ps(m.m_v + 0), _mm_load_ps(m.m_v + 12));
+    r = vm_madd(_mm_set1_ps(in[1]), _mm_load_ps(m.m_v + 4), r);
+    r = vm_madd(_mm_set1_ps(in[2]), _mm_load_ps(m.m_v + 8), r);
+    _mm_store_ps(t.m_v, r);
+    return vec3f(t.m_v);
+
+#elif defined(VECTORMATH_NEON)
+
+    vec4f t;
+    float32x4_t r = vmlaq_n_f32(vld1q_f32(m.m_v + 12), vld1q_f32(m.m_v + 0), in[0]);
+    r = vmlaq_n_f32(r, vld1q_f32(m.m_v + 4), in[1]);
+    r = vmlaq_n_f32(r, vld1q_f32(m.m_v + 8), in[2]);
+    vst1q_f32(t.m_v, r);
+    return vec3f(t.m_v);
+
+#else
+
+    return vec3f_mult_scalar(in, m);
+
+#endif
+}
+
+//
+// The six clip planes of the volume -w <= x, y, z <= w after transforming
+// by m, in the space m transforms from and in the same <a, b, c, D> form
+// as make_plane, normalized with normals pointing inward.  For a
+// projection matrix these are the eye-space view frustum planes; for
+// modelview * projection they are in object space.  Order is left, right,
+// bottom, top, near, far.
+//
+inline void make_clip_planes(const mat4f& m, vec4f planes[6])
+{
+    for(int i = 0; i < 3; i++) {
+        for(int j = 0; j < 4; j++) {
+            planes[i * 2 + 0][j] = m[j * 4 + 3] + m[j * 4 + i];
+            planes[i * 2 + 1][j] = m[j * 4 + 3] - m[j * 4 + i];
+        }
+    }
+    for(int i = 0; i < 6; i++) {
+        float len = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+        planes[i] /= len;
+    }
+}
+
+// Batch transforms of arrays of points (w = 1) or directions (w = 0) by a
+// single matrix, vectorized across points.  The AoS forms take byte strides
+// so they can walk interleaved vertex arrays like a loader's Vertex::v; in
+// and out may be the same array.  Directions are multiplied by m as given,
+// so pass the inverse transpose to transform normals.
+void transform_points(const mat4f& m, const float *in, size_t in_stride,
+    float *out, size_t out_stride, size_t count);
+void transform_directions(const mat4f& m, const float *in, size_t in_stride,
+    float *out, size_t out_stride, size_t count);
+void transform_points_soa(const mat4f& m, const float *x, const float *y, const float *z,
+    float *out_x, float *out_y, float *out_z, size_t count);
+void transform_directions_soa(const mat4f& m, const float *x, const float *y, const float *z,
+    float *out_x, float *out_y, float *out_z, size_t count);
+
+// Extend boxmin and boxmax by an AoS array of points, transformed by m
+// first if m is not NULL, without storing the transformed points.
+void extend_bounds(const float *in, size_t stride, size_t count, const mat4f *m,
+    vec3f& boxmin, vec3f& boxmax);
+
+// Octahedral mapping of unit vectors to [-1,1]^2 and back, for packing
+// normals into two components.
+vec2f oct_encode(const vec3f& n);
+vec3f oct_decode(const vec2f& e);
+
+// IEEE half-precision conversion, rounding to nearest even.
+unsigned short float_to_half(float f);
+float half_to_float(unsigned short h);
+
 // XXX There's ray code in the original projects/modules/singles/linmath.h
 
 #endif /* __VECTORMATH_H__ */
@@ -19,6 +19,9 @@
 #include <string>
 #include <limits>
 #include <algorithm>
+#include <vector>
+#include <cstring>
+#include <cstdint>
 #include <unistd.h>
 
 #define GLFW_INCLUDE_GLCOREARB
@@ -114,6 +117,8 @@ static bool CheckProgramLink(GLuint program)
 
 GLuint gVertexArray;
 GLuint gVertexBuffer;
+GLuint gEdgeBuffer; // GL_LINES indices, made on first wireframe draw
+GLsizei gEdgeIndexCount;
 
 GLuint gModelviewUniform;
 GLuint gModelviewNormalUniform;
@@ -268,6 +273,56 @@ void InitializeObject()
     glBindVertexArray(GL_NONE);
 }
 
+// Bind an element buffer of each distinct triangle edge to the vertex
+// array.  gVertices is a triangle soup, so vertices are matched by
+// position and each edge refers to the first vertex at its ends.
+void InitializeEdges()
+{
+    int vertexCount = gTriangleCount * 3;
+
+    std::vector<unsigned int> sorted(vertexCount);
+    for(int i = 0; i < vertexCount; i++)
+        sorted[i] = i;
+    std::sort(sorted.begin(), sorted.end(), [](unsigned int a, unsigned int b) {
+        int c = memcmp(gVertices[a].v, gVertices[b].v, sizeof(gVertices[a].v));
+        return c < 0 || (c == 0 && a < b);
+    });
+
+    std::vector<unsigned int> first(vertexCount);
+    for(int i = 0; i < vertexCount; i++) {
+        bool same = i > 0 && memcmp(gVertices[sorted[i]].v, gVertices[sorted[i - 1]].v, sizeof(gVertices[0].v)) == 0;
+        first[sorted[i]] = same ? first[sorted[i - 1]] : sorted[i];
+    }
+
+    std::vector<uint64_t> keys;
+    keys.reserve(vertexCount);
+    for(int i = 0; i < vertexCount; i++) {
+        uint64_t a = first[i];
+        uint64_t b = first[i / 3 * 3 + (i + 1) % 3];
+        if(a > b)
+            std::swap(a, b);
+        if(a != b)
+            keys.push_back((a << 32) | b);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    std::vector<unsigned int> edges;
+    edges.reserve(keys.size() * 2);
+    for(uint64_t k : keys) {
+        edges.push_back(k >> 32);
+        edges.push_back(k & 0xffffffff);
+    }
+    gEdgeIndexCount = edges.size();
+
+    glBindVertexArray(gVertexArray);
+    glGenBuffers(1, &gEdgeBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gEdgeBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, edges.size() * sizeof(unsigned int), edges.data(), GL_STATIC_DRAW);
+    glBindVertexArray(GL_NONE);
+    CheckOpenGL(__FILE__, __LINE__);
+}
+
 void DrawObject(float objectTime, bool drawWireframe)
 {
     CheckOpenGL(__FILE__, __LINE__);
@@ -282,12 +337,14 @@ void DrawObject(float objectTime, bool drawWireframe)
     glUniform1f(gMaterialShininessUniform, objectShininess);
     CheckOpenGL(__FILE__, __LINE__);
 
+    if(drawWireframe && gEdgeBuffer == 0)
+        InitializeEdges();
+
     glBindVertexArray(gVertexArray);
     CheckOpenGL(__FILE__, __LINE__);
 
     if(drawWireframe) {
-        for(int i = 0; i < gTriangleCount; i++)
-            glDrawArrays(GL_LINE_LOOP, i * 3, 3);
+        glDrawElements(GL_LINES, gEdgeIndexCount, GL_UNSIGNED_INT, 0);
     } else {
         glDrawArrays(GL_TRIANGLES, 0, gTriangleCount * 3);
     }
@@ -326,10 +383,7 @@ void DrawScene()
     /* draw floor, draw shadow, etc */
 
     mat4f modelview = gObjectManip->m_matrix * gSceneManip->m_matrix;
-    mat4f modelview_normal = modelview;
-    // XXX might not invert every time; parallel normal matrix math path?
-    modelview_normal.transpose();
-    modelview_normal.invert();
+    mat4f modelview_normal = modelview.normal_matrix();
     glUniformMatrix4fv(gModelviewUniform, 1, GL_FALSE, modelview.m_v);
     glUniformMatrix4fv(gModelviewNormalUniform, 1, GL_FALSE, modelview_normal.m_v);
     DrawObject(0, gDrawWireframe);
@@ -368,8 +422,7 @@ void InitializeGL()
 static void InitializeModel()
 {
     box bounds;
-    for(int i = 0; i < gTriangleCount * 3; i++)
-        bounds.extend(gVertices[i].v);
+    bounds.extend(gVertices[0].v, sizeof(Vertex), gTriangleCount * 3);
 
     gSceneManip = new manipulator(bounds, gFOV / 180.0 * 3.14159);
 
@@ -0,0 +1,75 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+#include "arena.h"
+
+using namespace std;
+
+FrameArena::FrameArena(size_t initialSize) :
+    blockAllocations(0),
+    used(0),
+    total(0)
+{
+    blocks.reserve(16);
+    AddBlock(initialSize);
+}
+
+FrameArena::~FrameArena()
+{
+    for(auto& b : blocks)
+        free(b.base);
+}
+
+void FrameArena::AddBlock(size_t size)
+{
+    Block b;
+    b.base = static_cast<unsigned char*>(malloc(size));
+    if(b.base == NULL)
+        throw bad_alloc();
+    b.size = size;
+    blocks.push_back(b);
+    blockAllocations++;
+    used = 0;
+}
+
+void *FrameArena::Allocate(size_t size, size_t alignment)
+{
+    // Blocks come from malloc, so offsets only need aligning relative to base
+    size_t start = (used + alignment - 1) & ~(alignment - 1);
+    if(start + size > blocks.back().size) {
+        AddBlock(max(blocks.back().size * 2, size));
+        start = 0;
+    }
+    used = start + size;
+    total += size + alignment;
+    return blocks.back().base + start;
+}
+
+void FrameArena::Reset()
+{
+    if(blocks.size() > 1) {
+        size_t size = max(total, blocks.back().size);
+        for(auto& b : blocks)
+            free(b.base);
+        blocks.clear();
+        AddBlock(size);
+    }
+    used = 0;
+    total = 0;
+}
@@ -0,0 +1,86 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <cstddef>
+#include <vector>
+
+//
+// Monotonic allocator for data that lives for one frame.  Allocate()
+// bumps a pointer and Reset() releases everything at once.  If a frame
+// spilled into more than one block, Reset() replaces them with a single
+// block big enough for that whole frame, so steady-state frames make no
+// heap allocations.
+//
+struct FrameArena
+{
+    size_t blockAllocations; // heap blocks allocated over the arena's lifetime
+
+    void *Allocate(size_t size, size_t alignment);
+    void Reset();
+
+    FrameArena(size_t initialSize = 64 * 1024);
+    ~FrameArena();
+
+private:
+    FrameArena(const FrameArena&);
+    FrameArena& operator=(const FrameArena&);
+
+    struct Block
+    {
+        unsigned char *base;
+        size_t size;
+    };
+    std::vector<Block> blocks; // the last is the one being allocated from
+    size_t used; // bytes used in the last block
+    size_t total; // bytes requested since Reset()
+
+    void AddBlock(size_t size);
+};
+
+// STL allocator drawing from a FrameArena; deallocate is a no-op.
+template <class T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+
+    FrameArena *arena;
+
+    ArenaAllocator(FrameArena *arena_) :
+        arena(arena_)
+    {}
+
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) :
+        arena(other.arena)
+    {}
+
+    T *allocate(size_t n) { return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T *, size_t) {}
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+template <class T>
+using FrameVector = std::vector<T, ArenaAllocator<T> >;
+
+#endif /* _ARENA_H_ */
@@ -15,6 +15,7 @@
 // 
 
 #include <string>
+#include <cstddef>
 #include <iostream>
 #include <map>
 #include <libgen.h>
@@ -29,6 +30,12 @@
 
 #include "assimp_loader.h"
 #include "phongshader.h"
+#include "geometrypool.h"
+#include "floatshape.h"
+#include "compactvertex.h"
+#include "meshoptimize.h"
+#include "vertexweld.h"
+#include "meshcache.h"
 
 #define GLFW_INCLUDE_GLCOREARB
 #include <GLFW/glfw3.h>
@@ -121,26 +128,17 @@ GLuint LoadTexture(const string& filename)
     return texture;
 }
 
-struct Vertex
+struct Vertex : public FloatVertex
 {
-    float v[3];
-    float n[3];
-    float c[4];
-    float t[2];
     Vertex() {}
     Vertex(float v_[3], float n_[3], float c_[4], float t_[2]) :
-        v{v_[0], v_[1], v_[2]},
-        n{n_[0], n_[1], n_[2]},
-        c{c_[0], c_[1], c_[2], c_[3]},
-        t{t_[0], t_[1]}
+        FloatVertex{{v_[0], v_[1], v_[2]}, {n_[0], n_[1], n_[2]}, {c_[0], c_[1], c_[2], c_[3]}, {t_[0], t_[1]}}
     {}
     Vertex(const vec3f& v_, const vec3f& n_, const vec4f& c_, const vec2f& t_) :
-        v{v_[0], v_[1], v_[2]},
-        n{n_[0], n_[1], n_[2]},
-        c{c_[0], c_[1], c_[2], c_[3]},
-        t{t_[0], t_[1]}
+        FloatVertex{{v_[0], v_[1], v_[2]}, {n_[0], n_[1], n_[2]}, {c_[0], c_[1], c_[2], c_[3]}, {t_[0], t_[1]}}
     {}
 };
+static_assert(sizeof(Vertex) == sizeof(FloatVertex), "Vertex arrays are passed as FloatVertex arrays");
 
 Vertex ConvertVertex(const aiMesh* mesh, int i)
 {
@@ -155,150 +153,48 @@ Vertex ConvertVertex(const aiMesh* mesh, int i)
     return Vertex(position, normal, color, texcoord);
 }
 
-struct VertexComparator
+// Convert mesh's vertices straight into the pool in the order
+// OptimizeMeshOrder gives, with no copy of them in between
+NodePtr MakeShapeInPlace(PhongShader::MaterialPtr mtl, const aiMesh* mesh, vector<unsigned int>& indices)
 {
-    bool operator()(const Vertex& v1, const Vertex& v2) const
-    {
-        for(int i = 0; i < 3; i++)
-            if(v1.v[i] < v2.v[i]) {
-                return true;
-            } else if(v1.v[i] > v2.v[i]) {
-                return false;
-            }
-        for(int i = 0; i < 3; i++)
-            if(v1.n[i] < v2.n[i]) {
-                return true;
-            } else if(v1.n[i] > v2.n[i]) {
-                return false;
-            }
-        for(int i = 0; i < 4; i++)
-            if(v1.c[i] < v2.c[i]) {
-                return true;
-            } else if(v1.c[i] > v2.c[i]) {
-                return false;
-            }
-        for(int i = 0; i < 2; i++)
-            if(v1.t[i] < v2.t[i]) {
-                return true;
-            } else if(v1.t[i] > v2.t[i]) {
-                return false;
-            }
-        return false;
-    }
-};
-
+    vector<unsigned int> remap;
+    size_t vertexCount = OptimizeMeshOrder(indices.data(), indices.size(), &mesh->mVertices[0].x, sizeof(aiVector3D), mesh->mNumVertices, remap);
 
-NodePtr MakeShape(PhongShader::MaterialPtr mtl, Vertex *vertices, size_t vertexCount, unsigned int *indices, int indexCount, bool textured)
-{
-    PhongShaderPtr shader = PhongShader::GetForCurrentContext();
-
-    PhongShader::ProgramVariant& vt = textured ? shader->textured : shader->nontextured;
-    glUseProgram(vt.program);
+    // Source of each vertex in turn, so mapped memory is written in order
+    vector<unsigned int> order(vertexCount);
+    box bounds;
+    for(unsigned int i = 0; i < mesh->mNumVertices; i++)
+        if(remap[i] != UNUSED_VERTEX) {
+            order[remap[i]] = i;
+            bounds.extend(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+        }
 
     DrawListPtr drawlist(new DrawList);
-    glGenVertexArrays(1, &drawlist->vertexArray);
-    glBindVertexArray(drawlist->vertexArray);
-    drawlist->indexed = true;
-    drawlist->indexType = GL_UNSIGNED_INT;
-    drawlist->prims.push_back(DrawList::PrimInfo(GL_TRIANGLES, 0, indexCount));
-    CheckOpenGL(__FILE__, __LINE__);
-
-    GLuint indexBuffer;
-    glGenBuffers(1, &indexBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indexCount, indices, GL_STATIC_DRAW);
-    CheckOpenGL(__FILE__, __LINE__);
-
-    GLuint vertexBuffer;
-    glGenBuffers(1, &vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertexCount, vertices, GL_STATIC_DRAW);
-    CheckOpenGL(__FILE__, __LINE__);
-
-    size_t coordSize = sizeof(float) * 3;
-    size_t normalSize = sizeof(float) * 3;
-    size_t colorSize = sizeof(float) * 4;
-    size_t texcoordSize = sizeof(float) * 2;
-
-    size_t stride = coordSize + normalSize + colorSize + texcoordSize;
-    size_t normalOffset = coordSize;
-    size_t colorOffset = normalOffset + normalSize;
-    size_t texcoordOffset = colorOffset + colorSize;
-
-    glVertexAttribPointer(vt.positionAttrib, 3, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(vt.positionAttrib);
-
-    glVertexAttribPointer(vt.normalAttrib, 3, GL_FLOAT, GL_FALSE, stride, (void*)normalOffset);
-    glEnableVertexAttribArray(vt.normalAttrib);
-
-    glVertexAttribPointer(vt.colorAttrib, 4, GL_FLOAT, GL_FALSE, stride, (void*)colorOffset);
-    glEnableVertexAttribArray(vt.colorAttrib);
-
-    if(textured) {
-        glVertexAttribPointer(vt.texcoordAttrib, 2, GL_FLOAT, GL_FALSE, stride, (void*)texcoordOffset);
-        glEnableVertexAttribArray(vt.texcoordAttrib);
-        CheckOpenGL(__FILE__, __LINE__);
-    }
-
-    glBindVertexArray(GL_NONE);
-
-    box bounds;
-    for(int i = 0; i < vertexCount; i++)
-        bounds.extend(vertices[i].v[0], vertices[i].v[1], vertices[i].v[2]);
+    drawlist->prims.push_back(DrawList::PrimInfo(GL_TRIANGLES, 0, indices.size()));
+
+    GeometryPool& pool = GeometryPool::Get(FloatVertexFormat());
+    pool.Allocate(*drawlist, vertexCount, GL_UNSIGNED_SHORT, indices.size());
+    do {
+        void *vertices, *shortIndices;
+        pool.Map(*drawlist, vertices, shortIndices);
+        for(size_t i = 0; i < vertexCount; i++)
+            ((Vertex *)vertices)[i] = ConvertVertex(mesh, order[i]);
+        for(size_t i = 0; i < indices.size(); i++)
+            ((unsigned short *)shortIndices)[i] = indices[i];
+    } while(!pool.Unmap(*drawlist));
 
     DrawablePtr drawable(new PhongShadedGeometry(drawlist, mtl, bounds));
+    if(gMeshRecorder)
+        gMeshRecorder->AddShape(drawable.get(), *mtl, vertexCount,
+            [&](size_t i) -> FloatVertex { return ConvertVertex(mesh, order[i]); },
+            indices.data(), indices.size());
     return ShapePtr(new Shape(drawable));
 }
 
-struct indexed_shape
-{
-    string name;
-
-    vec4f specular;
-    float shininess;
-
-    string texture_name;
-
-    vector<Vertex> vertices;
-    vector<unsigned int> indices;
-
-    void add_triangle(const Vertex& v0, const Vertex& v1, const Vertex& v2)
-    {
-        for(auto v : {v0, v1, v2}) {
-	    auto vx = vertex_map.find(v);
-
-	    if(true /* vx == vertex_map.end() */) {
-		vertices.push_back(v);
-
-		int index = vertices.size() - 1;
-		vertex_map[v] = index;
-		indices.push_back(index);
-
-	    } else {
-		indices.push_back(vx->second);
-	    }
-	}
-    }
-
-    map<Vertex, unsigned int, VertexComparator> vertex_map;      // only used during load
-
-    indexed_shape(const string& name_, const string& texture_name_, const vec4f& specular_, float shininess_) :
-        name(name_),
-        specular(specular_),
-        shininess(shininess_),
-        texture_name(texture_name_)
-    { }
-};
-
 tuple<bool, NodePtr> ConvertFacesSmooth(const aiMesh* mesh)
 {
-    vector<Vertex> vertices;
     vector<unsigned int> indices;
 
-    for(unsigned int j = 0; j < mesh->mNumVertices; j++) {
-        vertices.push_back(ConvertVertex(mesh, j));
-    }
-
     for(unsigned int j = 0; j < mesh->mNumFaces; j++) {
         const aiFace& face = mesh->mFaces[j];
 
@@ -324,7 +220,31 @@ tuple<bool, NodePtr> ConvertFacesSmooth(const aiMesh* mesh)
 
     PhongShader::MaterialPtr mtl(new PhongShader::Material(default_diffuse, default_ambient, vec4f(1, 1, 1, 1), 100));
 
-    return make_tuple(true, MakeShape(mtl, &vertices[0], vertices.size(), &indices[0], indices.size(), false));
+    // Splitting, quantizing and welding need the vertices in memory
+    if(mesh->mNumVertices <= SHORT_INDEXED_VERTICES && !gCompactVertices && gWeldEpsilon == 0)
+        return make_tuple(true, MakeShapeInPlace(mtl, mesh, indices));
+
+    vector<Vertex> vertices;
+
+    if(gWeldEpsilon > 0) {
+        // aiProcess_JoinIdenticalVertices joined only identical ones
+        VertexWelder welder(sizeof(Vertex) / sizeof(float), gWeldEpsilon);
+        vector<unsigned int> remap(mesh->mNumVertices);
+        for(unsigned int j = 0; j < mesh->mNumVertices; j++) {
+            Vertex v = ConvertVertex(mesh, j);
+            remap[j] = welder.Weld((const float *)&v);
+            if(remap[j] == vertices.size())
+                vertices.push_back(v);
+        }
+        for(unsigned int& index : indices)
+            index = remap[index];
+    } else {
+        for(unsigned int j = 0; j < mesh->mNumVertices; j++) {
+            vertices.push_back(ConvertVertex(mesh, j));
+        }
+    }
+
+    return make_tuple(true, MakeFloatShape(mtl, &vertices[0], vertices.size(), &indices[0], indices.size(), false));
 }
 
 tuple<bool, NodePtr> ConvertMesh(const aiMesh* mesh)
@@ -17,22 +17,22 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <cstddef>
 #include "builtin_loader.h"
 #include "phongshader.h"
+#include "geometrypool.h"
+#include "floatshape.h"
+#include "compactvertex.h"
+#include "vertexweld.h"
 
 using namespace std;
 
 namespace BuiltinLoader
 {
 
-struct Vertex
-{
-    float v[3];
-    float n[3];
-    float c[4];
-};
+typedef FloatVertex Vertex; // texcoords unused
 
-struct Vertex g256GonVertices[] = {
+Vertex g256GonVertices[] = {
     {{-6.673362, -20.048256, 98.813873}, {0.051548, -0.157062, 0.986243}, {1, 1, 1, 1}},
     {{9.004719, -0.883897, 100.570854}, {0.051548, -0.157062, 0.986243}, {1, 1, 1, 1}},
     {{-2.509216, -4.823700, 100.778732}, {0.051548, -0.157062, 0.986243}, {1, 1, 1, 1}},
@@ -3074,7 +3074,7 @@ struct Vertex g256GonVertices[] = {
 
 int g256GonTriangleCount = 1012;
 
-struct Vertex g64GonVertices[] = {
+Vertex g64GonVertices[] = {
     {{-31.531658, -5.454563, 98.880981}, {-0.042442, -0.098477, 0.994234}, {1, 1, 1, 1}},
     {{19.249924, 11.012655, 102.012672}, {-0.042442, -0.098477, 0.994234}, {1, 1, 1, 1}},
     {{-15.320923, 16.778076, 101.325745}, {-0.042442, -0.098477, 0.994234}, {1, 1, 1, 1}},
@@ -3811,124 +3811,45 @@ struct Vertex g64GonVertices[] = {
 
 int g64GonTriangleCount = 244;
 
-struct VertexComparator
-{
-    bool operator()(const Vertex& v1, const Vertex& v2) const
-    {
-        for(int i = 0; i < 3; i++)
-            if(v1.v[i] < v2.v[i]) {
-                return true;
-            } else if(v1.v[i] > v2.v[i]) {
-                return false;
-            }
-        for(int i = 0; i < 3; i++)
-            if(v1.n[i] < v2.n[i]) {
-                return true;
-            } else if(v1.n[i] > v2.n[i]) {
-                return false;
-            }
-        for(int i = 0; i < 4; i++)
-            if(v1.c[i] < v2.c[i]) {
-                return true;
-            } else if(v1.c[i] > v2.c[i]) {
-                return false;
-            }
-        return false;
-    }
-};
-
 NodePtr InitializePolytope(Vertex *vertices, int triangleCount)
 {
-    PhongShaderPtr shader = PhongShader::GetForCurrentContext();
-    PhongShader::ProgramVariant& nt = shader->nontextured;
-    glUseProgram(nt.program);
-
     static vec4f diffuse(.8, .7, .6, 1);
     static vec4f ambient(.16, .14, .12, 1);
     static vec4f specular(1, 1, 1, 1);
     static float shininess = 50;
     PhongShader::MaterialPtr mtl(new PhongShader::Material(diffuse, ambient, specular, shininess));
 
-    DrawListPtr drawlist(new DrawList);
-    glGenVertexArrays(1, &drawlist->vertexArray);
-    glBindVertexArray(drawlist->vertexArray);
-    drawlist->prims.push_back(DrawList::PrimInfo(GL_TRIANGLES, 0, triangleCount * 3));
-    CheckOpenGL(__FILE__, __LINE__);
-
-    GLuint vertexBuffer;
-    glGenBuffers(1, &vertexBuffer);
-
     const int do_indexing = true;
     if(do_indexing) {
 
         unsigned int indices[triangleCount * 3];
         vector<Vertex> unique_vertices;
-        map<Vertex, unsigned int, VertexComparator> vertex_map;
+        VertexWelder welder(sizeof(Vertex) / sizeof(float), gWeldEpsilon);
 
         for(int i = 0; i < triangleCount * 3; i++) {
             Vertex &v = vertices[i];
-            auto vx = vertex_map.find(v);
-            if(vx == vertex_map.end()) {
+            indices[i] = welder.Weld((const float *)&v);
+            if(indices[i] == unique_vertices.size())
                 unique_vertices.push_back(v);
-                unsigned int index = unique_vertices.size() - 1;
-                indices[i] = index;
-                vertex_map[v] = index;
-            } else {
-                indices[i] = vx->second;
-            }
         }
+        welder.Release();
 
-        if(false) printf("indexed %d vertices down to %zd vertices\n",
+        if(false) printf("indexed %d vertices down to %zu vertices\n",
             triangleCount * 3, unique_vertices.size());
 
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * unique_vertices.size(), &unique_vertices[0], GL_STATIC_DRAW);
-        CheckOpenGL(__FILE__, __LINE__);
-
-        GLuint indexBuffer;
-        glGenBuffers(1, &indexBuffer);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * triangleCount * 3, indices, GL_STATIC_DRAW);
-        CheckOpenGL(__FILE__, __LINE__);
-
-        drawlist->indexed = true;
-        drawlist->indexType = GL_UNSIGNED_INT;
-
-    } else {
-
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * triangleCount * 3, vertices, GL_STATIC_DRAW);
-        CheckOpenGL(__FILE__, __LINE__);
-
-        drawlist->indexed = false;
-
+        return MakeFloatShape(mtl, &unique_vertices[0], unique_vertices.size(), indices, triangleCount * 3, false);
     }
 
-    size_t coordSize = sizeof(float) * 3;
-    size_t normalSize = sizeof(float) * 3;
-    size_t colorSize = sizeof(float) * 4;
-
-    size_t stride = coordSize + normalSize + colorSize;
-    size_t normalOffset = coordSize;
-    size_t colorOffset = normalOffset + normalSize;
-
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-
-    glVertexAttribPointer(nt.positionAttrib, 3, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(nt.positionAttrib);
-
-    glVertexAttribPointer(nt.normalAttrib, 3, GL_FLOAT, GL_FALSE, stride, (void*)normalOffset);
-    glEnableVertexAttribArray(nt.normalAttrib);
-
-    glVertexAttribPointer(nt.colorAttrib, 4, GL_FLOAT, GL_FALSE, stride, (void*)colorOffset);
-    glEnableVertexAttribArray(nt.colorAttrib);
-    CheckOpenGL(__FILE__, __LINE__);
-
-    glBindVertexArray(GL_NONE);
+    DrawListPtr drawlist(new DrawList);
+    drawlist->prims.push_back(DrawList::PrimInfo(GL_TRIANGLES, 0, triangleCount * 3));
 
     box bounds;
-    for(int i = 0; i < triangleCount * 3; i++)
-        bounds.extend(vertices[i].v);
+    bounds.extend(vertices[0].v, sizeof(Vertex), triangleCount * 3);
+
+    if(gCompactVertices)
+        PlaceCompact(*drawlist, bounds, vertices[0].v, vertices[0].n, vertices[0].c, NULL, sizeof(Vertex), triangleCount * 3, NULL, 0);
+    else
+        GeometryPool::Get(FloatVertexFormat()).Place(*drawlist, vertices, triangleCount * 3, NULL, 0);
 
     DrawablePtr drawable(new PhongShadedGeometry(drawlist, mtl, bounds));
     return ShapePtr(new Shape(drawable));
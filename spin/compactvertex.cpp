@@ -0,0 +1,116 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "compactvertex.h"
+#include "geometrypool.h"
+#include "phongshader.h"
+
+bool gCompactVertices = false;
+
+static const float *Element(const float *base, size_t stride, size_t i)
+{
+    return (const float *)((const unsigned char *)base + stride * i);
+}
+
+static int16_t QuantizeSnorm16(float f)
+{
+    f = std::max(-1.0f, std::min(1.0f, f));
+    return (int16_t)lrintf(f * 32767.0f);
+}
+
+static uint16_t QuantizeUnorm16(float f)
+{
+    f = std::max(0.0f, std::min(1.0f, f));
+    return (uint16_t)lrintf(f * 65535.0f);
+}
+
+static uint8_t QuantizeUnorm8(float f)
+{
+    f = std::max(0.0f, std::min(1.0f, f));
+    return (uint8_t)lrintf(f * 255.0f);
+}
+
+void PlaceCompact(DrawList& dl, const box& bounds, const float *positions, const float *normals, const float *colors, const float *texcoords, size_t stride, size_t vertexCount, const unsigned int *indices, size_t indexCount)
+{
+    bool hasColors = false;
+    for(size_t i = 1; i < vertexCount && !hasColors; i++)
+        hasColors = memcmp(Element(colors, stride, i), colors, sizeof(float) * 4) != 0;
+
+    size_t size = 0;
+    const size_t positionOffset = size; size += sizeof(uint16_t) * 4;
+    const size_t normalOffset = size; size += sizeof(int16_t) * 2;
+    const size_t colorOffset = size; if(hasColors) size += sizeof(uint8_t) * 4;
+    const size_t texcoordOffset = size; if(texcoords) size += sizeof(uint16_t) * 2;
+
+    VertexFormat format(size);
+    format.Add(PhongShader::POSITION_LOCATION, 3, GL_UNSIGNED_SHORT, GL_TRUE, positionOffset);
+    format.Add(PhongShader::NORMAL_LOCATION, 2, GL_SHORT, GL_TRUE, normalOffset);
+    if(hasColors)
+        format.Add(PhongShader::COLOR_LOCATION, 4, GL_UNSIGNED_BYTE, GL_TRUE, colorOffset);
+    if(texcoords)
+        format.Add(PhongShader::TEXCOORD_LOCATION, 2, GL_HALF_FLOAT, GL_FALSE, texcoordOffset);
+
+    // Flat extents decode to the box's face
+    vec3f extent = bounds.m_max - bounds.m_min;
+    vec3f inverse;
+    for(int j = 0; j < 3; j++)
+        inverse[j] = (extent[j] > 0) ? 1.0f / extent[j] : 0.0f;
+
+    std::vector<unsigned char> vertices(size * vertexCount);
+    for(size_t i = 0; i < vertexCount; i++) {
+        unsigned char *v = &vertices[size * i];
+
+        const float *p = Element(positions, stride, i);
+        uint16_t *position = (uint16_t *)(v + positionOffset);
+        for(int j = 0; j < 3; j++)
+            position[j] = QuantizeUnorm16((p[j] - bounds.m_min[j]) * inverse[j]);
+        position[3] = 0;
+
+        const float *n = Element(normals, stride, i);
+        vec2f e = oct_encode(vec3f(n[0], n[1], n[2]));
+        int16_t *normal = (int16_t *)(v + normalOffset);
+        normal[0] = QuantizeSnorm16(e[0]);
+        normal[1] = QuantizeSnorm16(e[1]);
+
+        if(hasColors) {
+            const float *c = Element(colors, stride, i);
+            for(int j = 0; j < 4; j++)
+                v[colorOffset + j] = QuantizeUnorm8(c[j]);
+        }
+
+        if(texcoords) {
+            const float *t = Element(texcoords, stride, i);
+            uint16_t *texcoord = (uint16_t *)(v + texcoordOffset);
+            texcoord[0] = float_to_half(t[0]);
+            texcoord[1] = float_to_half(t[1]);
+        }
+    }
+
+    GeometryPool::Get(format).Place(dl, vertices.data(), vertexCount, indices, indexCount);
+
+    dl.compact = true;
+    dl.positionScale = vec4f(extent[0], extent[1], extent[2], 0);
+    dl.positionOffset = vec4f(bounds.m_min[0], bounds.m_min[1], bounds.m_min[2], 0);
+    dl.hasColors = hasColors;
+    if(!hasColors && vertexCount > 0)
+        dl.color = vec4f(colors[0], colors[1], colors[2], colors[3]);
+}
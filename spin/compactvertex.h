@@ -0,0 +1,39 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#ifndef _COMPACTVERTEX_H_
+#define _COMPACTVERTEX_H_
+
+#include <cstddef>
+#include "drawable.h"
+
+// Loaders store shapes with PlaceCompact if set (spin's -q option)
+extern bool gCompactVertices;
+
+//
+// Quantize a shape's vertices into the compact layout, store them in the
+// GeometryPool for that layout, and set dl's decoding state:
+//     position    3 x unorm16 within bounds, padded to 8 bytes
+//     normal      2 x snorm16, octahedral
+//     color       4 x unorm8, left out if all vertices have one color
+//     texcoord    2 x half float, left out if texcoords is NULL
+// The arrays are read with the same byte stride.  dl's prims are as for
+// GeometryPool::Place.
+//
+void PlaceCompact(DrawList& dl, const box& bounds, const float *positions, const float *normals, const float *colors, const float *texcoords, size_t stride, size_t vertexCount, const unsigned int *indices, size_t indexCount);
+
+#endif /* _COMPACTVERTEX_H_ */
@@ -14,64 +14,234 @@
 // limitations under the License.
 // 
 
+#include <cstring>
+#include <algorithm>
 #include "drawable.h"
+#include "glstate.h"
 
 using namespace std;
 
+// Append to edges the index pairs of the distinct edges of triangles
+static void AppendUniqueEdges(const vector<unsigned int>& triangles, vector<unsigned int>& edges)
+{
+    vector<uint64_t> keys;
+    keys.reserve(triangles.size());
+
+    for(size_t t = 0; t + 2 < triangles.size(); t += 3)
+        for(int e = 0; e < 3; e++) {
+            uint64_t a = triangles[t + e];
+            uint64_t b = triangles[t + (e + 1) % 3];
+            if(a > b)
+                std::swap(a, b);
+            if(a != b)
+                keys.push_back((a << 32) | b);
+        }
+
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+    for(uint64_t k : keys) {
+        edges.push_back(k >> 32);
+        edges.push_back(k & 0xffffffff);
+    }
+}
+
+bool MultiDraw::Append(const DrawList& dl)
+{
+    if(!empty() && (dl.vertexArray != vertexArray || dl.indexed != indexed ||
+        (indexed && dl.indexType != indexType)))
+        return false;
+
+    vertexArray = dl.vertexArray;
+    indexed = dl.indexed;
+    indexType = dl.indexType;
+    for(size_t i = 0; i < dl.prims.size(); i++) {
+        const DrawList::PrimInfo& p = dl.prims[i];
+        Append(p.type, p.start, p.count, dl.baseVertex);
+    }
+    return true;
+}
+
+void MultiDraw::Append(GLenum type, GLint start, GLsizei count, GLint baseVertex)
+{
+    types.push_back(type);
+    counts.push_back(count);
+    if(indexed) {
+        int indexsize = (indexType == GL_UNSIGNED_SHORT) ? 2 : 4; // XXX no BYTE
+        unsigned char *baseptr = 0;
+        offsets.push_back(baseptr + indexsize * start);
+        baseVertices.push_back(baseVertex);
+    } else
+        firsts.push_back(start + baseVertex);
+}
+
+void MultiDraw::Submit() const
+{
+    if(empty())
+        return;
+
+    gGLState.BindVertexArray(vertexArray);
+    CheckOpenGL(__FILE__, __LINE__);
+
+    size_t i = 0;
+    while(i < types.size()) {
+        size_t end = i + 1;
+        while(end < types.size() && types[end] == types[i])
+            end++;
+
+        if(indexed)
+            glMultiDrawElementsBaseVertex(types[i], &counts[i], indexType, &offsets[i], end - i, &baseVertices[i]);
+        else
+            glMultiDrawArrays(types[i], &firsts[i], &counts[i], end - i);
+
+        i = end;
+    }
+
+    CheckOpenGL(__FILE__, __LINE__);
+}
+
+void MultiDraw::Clear()
+{
+    types.clear();
+    counts.clear();
+    offsets.clear();
+    firsts.clear();
+    baseVertices.clear();
+}
+
+void DrawList::MakeEdges()
+{
+    gGLState.BindVertexArray(vertexArray);
+
+    GLint binding = 0;
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &binding);
+    indexBuffer = binding;
+
+    vector<unsigned int> edges;
+    vector<unsigned int> triangles;
+
+    edgeRanges.vertexArray = vertexArray;
+    edgeRanges.indexed = true;
+    edgeRanges.indexType = GL_UNSIGNED_INT;
+
+    for(size_t i = 0; i < prims.size(); i++) {
+        const DrawList::PrimInfo& p = prims[i];
+        if(p.type != GL_TRIANGLES)
+            continue;
+
+        triangles.resize(p.count);
+        if(indexed) {
+            if(indexType == GL_UNSIGNED_SHORT) {
+                vector<unsigned short> shorts(p.count);
+                glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, p.start * 2, p.count * 2, &shorts[0]);
+                std::copy(shorts.begin(), shorts.end(), triangles.begin());
+            } else
+                glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, p.start * 4, p.count * 4, &triangles[0]);
+        } else
+            for(int j = 0; j < p.count; j++)
+                triangles[j] = p.start + j;
+
+        size_t start = edges.size();
+        AppendUniqueEdges(triangles, edges);
+        edgeRanges.Append(GL_LINES, start, edges.size() - start, baseVertex);
+    }
+
+    glGenBuffers(1, &edgeBuffer);
+    gGLState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, edgeBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, edges.size() * sizeof(unsigned int), edges.data(), GL_STATIC_DRAW);
+    gGLState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    CheckOpenGL(__FILE__, __LINE__);
+}
+
 void DrawList::Draw(bool drawWireframe)
 {
-    glBindVertexArray(vertexArray);
+    if(drawWireframe && edgeBuffer == 0)
+        MakeEdges();
+
+    if(drawWireframe) {
+        // Borrow the vertex array's element binding for the edges
+        gGLState.BindVertexArray(vertexArray);
+        gGLState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, edgeBuffer);
+        edgeRanges.Submit();
+        gGLState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    } else {
+        if(ranges.empty())
+            ranges.Append(*this);
+        ranges.Submit();
+    }
+
+    CheckOpenGL(__FILE__, __LINE__);
+}
+
+void DrawList::DrawInstanced(GLsizei instances)
+{
+    gGLState.BindVertexArray(vertexArray);
     CheckOpenGL(__FILE__, __LINE__);
 
     if(indexed) {
         int indexsize = (indexType == GL_UNSIGNED_SHORT) ? 2 : 4; // XXX no BYTE
         unsigned char *baseptr = 0;
-        if(drawWireframe) {
-            for(size_t i = 0; i < prims.size(); i++) {
-                const DrawList::PrimInfo& p = prims[i];
-                if(p.type == GL_TRIANGLES)
-                    for(int j = 0; j < prims[i].count / 3; j++)
-                        glDrawElements(GL_LINE_LOOP, 3, indexType, (const GLvoid*)(baseptr + indexsize * (p.start + j * 3)));
-            }
-        } else {
-            // Leave loop in here instead of elevating because will
-            // eventually move to MultiDraw, I think
-            for(size_t i = 0; i < prims.size(); i++) {
-                const DrawList::PrimInfo& p = prims[i];
-                glDrawElements(p.type, p.count, indexType, (const GLvoid*)(baseptr + indexsize * p.start));
-            }
+        for(size_t i = 0; i < prims.size(); i++) {
+            const DrawList::PrimInfo& p = prims[i];
+            glDrawElementsInstancedBaseVertex(p.type, p.count, indexType, (const GLvoid*)(baseptr + indexsize * p.start), instances, baseVertex);
         }
     } else {
-        if(drawWireframe) {
-            for(size_t i = 0; i < prims.size(); i++) {
-                const DrawList::PrimInfo& p = prims[i];
-                if(p.type == GL_TRIANGLES)
-                    for(int j = 0; j < prims[i].count / 3; j++)
-                        glDrawArrays(GL_LINE_LOOP, p.start + j * 3, 3);
-            }
-        } else {
-            // Leave loop in here instead of elevating because will
-            // eventually move to MultiDraw, I think
-            for(size_t i = 0; i < prims.size(); i++) {
-                const DrawList::PrimInfo& p = prims[i];
-                glDrawArrays(p.type, p.start, p.count);
-            }
+        for(size_t i = 0; i < prims.size(); i++) {
+            const DrawList::PrimInfo& p = prims[i];
+            glDrawArraysInstanced(p.type, p.start + baseVertex, p.count, instances);
         }
     }
 
     CheckOpenGL(__FILE__, __LINE__);
 }
 
+bool DrawList::DecodesLike(const DrawList& other) const
+{
+    if(compact != other.compact || hasColors != other.hasColors)
+        return false;
+    if(compact && !(positionScale == other.positionScale && positionOffset == other.positionOffset))
+        return false;
+    return hasColors || color == other.color;
+}
+
+// Returns true if bounds, transformed by modelview, are entirely outside
+// the environment's frustum.  Clears the bits in planes for planes the
+// bounds are entirely inside, so nodes below need not test them again.
+static bool Culled(const box& bounds, const mat4f& modelview, const Environment& env, unsigned int& planes)
+{
+    if(env.frustum == NULL || planes == 0)
+        return false;
+
+    if(bounds.is_empty())
+        return true;
+
+    box eyebounds = bounds * modelview;
+    for(int i = 0; i < 6; i++) {
+        if(!(planes & (1u << i)))
+            continue;
+        int side = box_plane_side(eyebounds, env.frustum[i]);
+        if(side < 0)
+            return true;
+        if(side > 0)
+            planes &= ~(1u << i);
+    }
+    return false;
+}
+
 void Shape::Visit(const Environment& env, DisplayList& displaylist)
 {
-    displaylist[DisplayInfo(env.modelview, env.projection, drawable->GetProgram(), drawable->GetEnvironmentUniforms())].push_back(drawable);
+    unsigned int planes = env.cullPlanes;
+    if(Culled(bounds, env.modelview, env, planes))
+        return;
+
+    displaylist.Add(env, drawable.get());
 }
 
-box TransformedBounds(const mat4f& transform, vector<NodePtr> children)
+box TransformedBounds(const mat4f& transform, const vector<NodePtr>& children)
 {
     box b;
 
-    for(auto child : children)
+    for(const NodePtr& child : children)
         b.extend(child->bounds * transform);
 
     return b;
@@ -80,11 +250,203 @@ box TransformedBounds(const mat4f& transform, vector<NodePtr> children)
 void Group::Visit(const Environment& env, DisplayList& displaylist)
 {
     mat4f newtransform = transform * env.modelview;
-    Environment env2(env.projection, newtransform, env.lights);
-    for(auto child : children)
+
+    unsigned int planes = env.cullPlanes;
+    if(Culled(childBounds, newtransform, env, planes))
+        return;
+
+    Environment env2(env.projection, newtransform, env.lights, env.frustum, planes);
+    for(const NodePtr& child : children)
         child->Visit(env2, displaylist);
 }
 
+// Forget v's arena storage so the arena can be reset under it
+template <class T>
+static void ReleaseFrameVector(FrameVector<T>& v, FrameArena& arena)
+{
+    v = FrameVector<T>(ArenaAllocator<T>(&arena));
+}
+
+void DisplayList::Clear()
+{
+    size_t matrixCount = matrices.size();
+    size_t packetCount = packets.size();
+    size_t batchCount = batches.size();
+    size_t instanceMatrixCount = instanceMatrices.size();
+
+    ReleaseFrameVector(matrices, arena);
+    ReleaseFrameVector(packets, arena);
+    ReleaseFrameVector(order, arena);
+    ReleaseFrameVector(batches, arena);
+    ReleaseFrameVector(instanceMatrices, arena);
+    ReleaseFrameVector(scratch, arena);
+    arena.Reset();
+
+    // Reserve last frame's sizes so an unchanged scene doesn't grow them
+
+    matrices.reserve(matrixCount);
+    packets.reserve(packetCount);
+    order.reserve(packetCount);
+    batches.reserve(batchCount);
+    instanceMatrices.reserve(instanceMatrixCount);
+    scratch.reserve(packetCount);
+
+    lastModelview = ~0u;
+    lastProjection = ~0u;
+}
+
+// Siblings share a modelview and every draw shares the projection, so
+// only append a matrix if it differs from the last one added in its role.
+unsigned int DisplayList::AddMatrix(const mat4f& m, unsigned int& last)
+{
+    if(last != ~0u && memcmp(matrices[last].m_v, m.m_v, sizeof(m.m_v)) == 0)
+        return last;
+    matrices.push_back(m);
+    last = matrices.size() - 1;
+    return last;
+}
+
+// Map a float to a uint32 that sorts the same way for values >= 0;
+// anything behind the eye sorts first.
+static uint32_t DepthBits(float depth)
+{
+    if(!(depth > 0))
+        return 0;
+    uint32_t bits;
+    memcpy(&bits, &depth, sizeof(bits));
+    return bits;
+}
+
+void DisplayList::Add(const Environment& env, Drawable *drawable)
+{
+    Add(env.modelview, env.projection, drawable);
+}
+
+void DisplayList::Add(const mat4f& modelview, const mat4f& projection, Drawable *drawable)
+{
+    Packet p;
+    p.drawable = drawable;
+    p.program = drawable->GetProgram();
+    p.envu = drawable->GetEnvironmentUniforms();
+    p.modelview = AddMatrix(modelview, lastModelview);
+    p.projection = AddMatrix(projection, lastProjection);
+
+    const box& b = drawable->bounds;
+    vec3f center = (b.m_min + b.m_max) * .5f;
+    float depth = -(center * modelview)[2];
+
+    SortEntry e;
+    e.key = ((uint64_t)(p.program & 0xff) << 56) |
+        ((uint64_t)(drawable->GetMaterialKey() & 0xffffff) << 32) |
+        DepthBits(depth);
+    e.packet = packets.size();
+
+    packets.push_back(p);
+    order.push_back(e);
+}
+
+// LSD radix sort of order[] by key, 8 bits per pass.  Passes in which
+// every key has the same byte are skipped, which is common for the
+// program and material bytes.
+void DisplayList::Sort()
+{
+    size_t count = order.size();
+    if(count < 2) {
+        MakeBatches();
+        return;
+    }
+
+    scratch.resize(count);
+
+    size_t histogram[8][256] = {};
+    for(size_t i = 0; i < count; i++) {
+        uint64_t key = order[i].key;
+        for(int pass = 0; pass < 8; pass++)
+            histogram[pass][(key >> (pass * 8)) & 0xff]++;
+    }
+
+    SortEntry *src = &order[0];
+    SortEntry *dst = &scratch[0];
+    for(int pass = 0; pass < 8; pass++) {
+        size_t *h = histogram[pass];
+        int shift = pass * 8;
+
+        if(h[(src[0].key >> shift) & 0xff] == count)
+            continue;
+
+        size_t offset = 0;
+        for(int i = 0; i < 256; i++) {
+            size_t n = h[i];
+            h[i] = offset;
+            offset += n;
+        }
+
+        for(size_t i = 0; i < count; i++)
+            dst[h[(src[i].key >> shift) & 0xff]++] = src[i];
+
+        std::swap(src, dst);
+    }
+
+    if(src != &order[0])
+        std::copy(src, src + count, order.begin());
+
+    MakeBatches();
+}
+
+void DisplayList::MakeBatches()
+{
+    size_t count = order.size();
+    size_t i = 0;
+
+    while(i < count) {
+        size_t runEnd = i + 1;
+
+        if(instancing) {
+            // Gather each Drawable's packets within the run of this
+            // program and material; std::sort doesn't allocate
+            while(runEnd < count && (order[runEnd].key >> 32) == (order[i].key >> 32))
+                runEnd++;
+            if(runEnd - i > 1)
+                std::sort(order.begin() + i, order.begin() + runEnd,
+                    [this](const SortEntry& a, const SortEntry& b) {
+                        const Packet& pa = packets[a.packet];
+                        const Packet& pb = packets[b.packet];
+                        if(pa.drawable != pb.drawable)
+                            return pa.drawable < pb.drawable;
+                        if(pa.projection != pb.projection)
+                            return pa.projection < pb.projection;
+                        return a.key < b.key;
+                    });
+        }
+
+        while(i < runEnd) {
+            const Packet& first = packets[order[i].packet];
+            size_t end = i + 1;
+
+            if(instancing && first.drawable->GetInstancedProgram() != 0)
+                while(end < runEnd &&
+                    packets[order[end].packet].drawable == first.drawable &&
+                    packets[order[end].packet].projection == first.projection)
+                    end++;
+
+            Batch b;
+            b.first = i;
+            b.count = end - i;
+            b.instanceBase = instanceMatrices.size() / 2;
+
+            if(b.count > 1)
+                for(size_t j = i; j < end; j++) {
+                    const mat4f& m = matrices[packets[order[j].packet].modelview];
+                    instanceMatrices.push_back(m);
+                    instanceMatrices.push_back(m.normal_matrix());
+                }
+
+            batches.push_back(b);
+            i = end;
+        }
+    }
+}
+
 void CheckOpenGL(const char *filename, int line)
 {
     int glerr;
@@ -18,16 +18,50 @@
 #define _DRAWABLE_H_
 
 #include <vector>
-#include <map>
 #include <memory>
+#include <cstdint>
 
 #define GLFW_INCLUDE_GLCOREARB
 #include <GLFW/glfw3.h>
 
 #include "geometry.h"
+#include "arena.h"
 
 void CheckOpenGL(const char *filename, int line);
 
+struct DrawList;
+struct GeometryRange;
+
+//
+// Ranges of one or more DrawLists that share a vertex array and index
+// type, submitted with one glMultiDrawElementsBaseVertex or
+// glMultiDrawArrays call per run of equal primitive type.
+//
+struct MultiDraw
+{
+    GLuint vertexArray;
+    bool indexed;
+    GLenum indexType;
+    std::vector<GLenum> types;
+    std::vector<GLsizei> counts;
+    std::vector<const GLvoid*> offsets; // byte offsets, if indexed
+    std::vector<GLint> firsts; // first vertex, if not indexed
+    std::vector<GLint> baseVertices; // if indexed
+
+    // Returns false, appending nothing, if dl doesn't share vertex state
+    bool Append(const DrawList& dl);
+    void Append(GLenum type, GLint start, GLsizei count, GLint baseVertex);
+    void Submit() const;
+    void Clear();
+    bool empty() const { return counts.empty(); }
+
+    MultiDraw() :
+        vertexArray(0),
+        indexed(false),
+        indexType(GL_NONE)
+    {}
+};
+
 struct DrawList
 {
     struct PrimInfo {
@@ -43,25 +77,77 @@ struct DrawList
     GLuint vertexArray;
     bool indexed;
     GLenum indexType;
+    GLint baseVertex; // added to each index, for lists sharing a vertex buffer
     std::vector<PrimInfo> prims;
+    std::shared_ptr<GeometryRange> geometry; // pool storage, if from a GeometryPool
+
+    // Wireframe is drawn as GL_LINES of each triangle's edges, with
+    // edges shared within a prim listed once.  edgeBuffer holds
+    // GL_UNSIGNED_INT indices and is built on the first wireframe Draw.
+    GLuint indexBuffer; // vertexArray's own element buffer, if indexed
+    GLuint edgeBuffer;
+    MultiDraw edgeRanges; // GL_LINES ranges in edgeBuffer
+
+    // Vertices in the compact layout (see compactvertex.h) are decoded
+    // by the program with this state
+    bool compact;
+    vec4f positionScale; // position = stored * scale + offset
+    vec4f positionOffset;
+    bool hasColors; // else every vertex has color
+    vec4f color;
+
     void Draw(bool drawWireframe);
+    void DrawInstanced(GLsizei instances); // filled only
+    bool DecodesLike(const DrawList& other) const;
     DrawList() :
         vertexArray(0),
-        indexed(false)
+        indexed(false),
+        baseVertex(0),
+        indexBuffer(0),
+        edgeBuffer(0),
+        compact(false),
+        positionScale(1, 1, 1, 0),
+        positionOffset(0, 0, 0, 0),
+        hasColors(true),
+        color(1, 1, 1, 1)
     {}
+
+private:
+    MultiDraw ranges; // prims, made on first Draw
+    void MakeEdges();
 };
 typedef std::shared_ptr<DrawList> DrawListPtr;
 
-struct EnvironmentUniforms
+// Environment and per-object state reach programs through std140
+// uniform blocks at fixed binding points; these mirror the blocks.
+struct EnvironmentBlock // "Environment", once per frame
 {
-    GLuint modelview;
-    GLuint modelviewNormal;
-    GLuint projection;
+    mat4f projection;
+    vec4f lightPosition;
+    vec4f lightColor;
+};
 
-    GLuint lightPosition;
-    GLuint lightColor;
+struct ObjectBlock // "Object", bound per draw
+{
+    mat4f modelview;
+    mat4f modelviewNormal;
 };
 
+const GLuint ENVIRONMENT_UNIFORM_BINDING = 0;
+const GLuint OBJECT_UNIFORM_BINDING = 1;
+const GLuint MATERIAL_UNIFORM_BINDING = 2; // layout up to the program
+
+// Uniforms not in blocks
+struct EnvironmentUniforms
+{
+    // Instanced programs only; -1 otherwise
+    GLuint instanceMatrices; // samplerBuffer of modelview, normal matrix per instance
+    GLuint instanceBase; // first instance's index in instanceMatrices
+};
+
+// Texture unit the instance matrix buffer is bound to
+const GLint INSTANCE_MATRIX_TEXTURE_UNIT = 1;
+
 struct Drawable
 {
     box bounds;
@@ -74,6 +160,17 @@ struct Drawable
     virtual void Draw(float objectTime, bool drawWireframe) = 0;
     virtual GLuint GetProgram() = 0;
     virtual EnvironmentUniforms GetEnvironmentUniforms() = 0;
+    // Draws with equal keys share material state; used to order draws
+    virtual unsigned int GetMaterialKey() { return 0; }
+    // Program drawing gl_InstanceID's matrices from the instance buffer,
+    // or 0 if this Drawable can't be instanced
+    virtual GLuint GetInstancedProgram() { return 0; }
+    virtual EnvironmentUniforms GetInstancedEnvironmentUniforms() { return EnvironmentUniforms(); }
+    virtual void DrawInstanced(float objectTime, GLsizei instances) {}
+    // True if other's material state is identical, so that their filled
+    // DrawLists may be submitted together through DrawRanges
+    virtual bool SharesStateWith(const Drawable& other) { return false; }
+    virtual void DrawRanges(float objectTime, const MultiDraw& ranges) {}
     virtual ~Drawable() {}
 };
 typedef std::shared_ptr<Drawable> DrawablePtr;
@@ -92,60 +189,108 @@ struct Environment
 {
     mat4f projection;
     mat4f modelview;
-    std::vector<Light> lights; // only one supported at present
+    const std::vector<Light>& lights; // only one supported at present; not owned
+    const vec4f *frustum; // eye-space planes from make_clip_planes, NULL to not cull
+    unsigned int cullPlanes; // bit i set if frustum[i] still needs testing
 
-    Environment(const mat4f& projection_, const mat4f& modelview_, const std::vector<Light>& lights_) :
+    Environment(const mat4f& projection_, const mat4f& modelview_, const std::vector<Light>& lights_, const vec4f *frustum_ = NULL, unsigned int cullPlanes_ = 0x3f) :
         projection(projection_),
         modelview(modelview_),
-        lights(lights_)
+        lights(lights_),
+        frustum(frustum_),
+        cullPlanes(cullPlanes_)
     {}
 };
 
-struct DisplayInfo
+//
+// Flat per-frame queue of draws.  Visit appends one Packet per Drawable
+// with indices of its matrices, Sort() orders the packets by a 64-bit key
+// with a radix sort, and DrawScene walks order[] issuing state changes
+// only where consecutive packets differ.
+//
+// Key layout, most significant first:
+//     8 bits program, 24 bits material, 32 bits eye depth
+// so draws group by program, then by material, then front to back.
+// Bits only order draws; state is always taken from the Packet, so
+// truncated keys that collide cost efficiency but not correctness.
+//
+// Sort() then splits order[] into Batches.  With instancing set, packets
+// for the same Drawable within a run of equal program and material are
+// made adjacent (giving up depth order within the run) and become one
+// Batch whose modelview and normal matrices are appended to
+// instanceMatrices, for one instanced draw.
+//
+// All arrays come from a FrameArena reset by Clear(), and are reserved at
+// the previous frame's sizes, so an unchanging scene allocates nothing.
+//
+struct DisplayList
 {
-    mat4f modelview;
-    mat4f projection;
-    GLuint program;
-    EnvironmentUniforms envu; // XXX Clumsy?  Really tied to program, so shouldn't be independent here
+    struct Packet
+    {
+        Drawable *drawable; // owned by the scene graph
+        GLuint program;
+        EnvironmentUniforms envu;
+        unsigned int modelview; // index into matrices
+        unsigned int projection; // index into matrices
+    };
 
-    DisplayInfo(const mat4f& modelview_, const mat4f& projection_, GLuint program_, const EnvironmentUniforms& envu_) :
-        modelview(modelview_),
-        projection(projection_),
-        program(program_),
-        envu(envu_)
-    {}
+    struct SortEntry
+    {
+        uint64_t key;
+        unsigned int packet;
+    };
 
-    struct Comparator
+    struct Batch
     {
-        bool operator() (const DisplayInfo& d1, const DisplayInfo& d2) const
-        {
-            for(int i = 0; i < 16; i++) {
-                if(d1.modelview.m_v[i] < d2.modelview.m_v[i])
-                    return true;
-                if(d1.modelview.m_v[i] < d2.modelview.m_v[i])
-                    return false;
-            }
-            for(int i = 0; i < 16; i++) {
-                if(d1.projection.m_v[i] < d2.projection.m_v[i])
-                    return true;
-                if(d1.projection.m_v[i] < d2.projection.m_v[i])
-                    return false;
-            }
-            if(d1.program < d2.program)
-                return true;
-            if(d1.program < d2.program)
-                return false;
-            return false;
-        }
+        unsigned int first; // index into order
+        unsigned int count; // > 1 only if instanced
+        unsigned int instanceBase; // index of first instance, if instanced
     };
 
+    FrameArena arena;
+    FrameVector<mat4f> matrices;
+    FrameVector<Packet> packets;
+    FrameVector<SortEntry> order;
+    FrameVector<Batch> batches;
+    FrameVector<mat4f> instanceMatrices; // modelview, normal matrix per instance
+    bool instancing;
+
+    void Clear();
+    void Add(const Environment& env, Drawable *drawable);
+    void Add(const mat4f& modelview, const mat4f& projection, Drawable *drawable);
+    void Sort();
+
+    DisplayList() :
+        matrices(ArenaAllocator<mat4f>(&arena)),
+        packets(ArenaAllocator<Packet>(&arena)),
+        order(ArenaAllocator<SortEntry>(&arena)),
+        batches(ArenaAllocator<Batch>(&arena)),
+        instanceMatrices(ArenaAllocator<mat4f>(&arena)),
+        instancing(false),
+        scratch(ArenaAllocator<SortEntry>(&arena)),
+        lastModelview(~0u),
+        lastProjection(~0u)
+    {}
+
+private:
+    DisplayList(const DisplayList&);
+    DisplayList& operator=(const DisplayList&);
+
+    FrameVector<SortEntry> scratch;
+    unsigned int lastModelview;
+    unsigned int lastProjection;
+    unsigned int AddMatrix(const mat4f& m, unsigned int& last);
+    void MakeBatches();
 };
-typedef std::map<DisplayInfo, std::vector<DrawablePtr>, DisplayInfo::Comparator> DisplayList;
+
+struct FlatScene;
 
 struct Node
 {
-    box bounds; // Later can cull
+    box bounds; // in the space of the parent, used for culling
     virtual void Visit(const Environment& env, DisplayList& displaylist) = 0;
+    // Append this node and its subtree to scene under node index parent
+    virtual void Flatten(FlatScene& scene, int parent) = 0;
 
     Node(const box& bounds_) :
         bounds(bounds_)
@@ -158,6 +303,7 @@ struct Shape : public Node
 {
     DrawablePtr drawable;
     virtual void Visit(const Environment& env, DisplayList& displaylist);
+    virtual void Flatten(FlatScene& scene, int parent);
     Shape(DrawablePtr& drawable_) :
         Node(drawable_->bounds),
         drawable(drawable_)
@@ -166,25 +312,40 @@ struct Shape : public Node
 };
 typedef std::shared_ptr<Shape> ShapePtr;
 
-box TransformedBounds(const mat4f& transform, std::vector<NodePtr> children);
+box TransformedBounds(const mat4f& transform, const std::vector<NodePtr>& children);
 
 struct Group : public Node 
 {
+    // Change with SetTransform so FlatScene sees it and refits ancestors'
+    // bounds; bounds kept in the graph itself are from construction
     mat4f transform;
     std::vector<NodePtr> children;
+    box childBounds; // bounds of children before transform, for culling
+    unsigned int version; // incremented by SetTransform
 
     virtual void Visit(const Environment& env, DisplayList& displaylist);
+    virtual void Flatten(FlatScene& scene, int parent);
+
+    void SetTransform(const mat4f& transform_)
+    {
+        transform = transform_;
+        version++;
+    }
 
     Group(const mat4f& transform_, std::vector<NodePtr> children_) :
         Node(TransformedBounds(transform_, children_)),
         transform(transform_),
-        children(children_)
+        children(children_),
+        childBounds(TransformedBounds(mat4f::identity, children_)),
+        version(0)
     {}
 
     Group(std::vector<NodePtr> children_) :
         Node(TransformedBounds(mat4f::identity, children_)),
         transform(mat4f::identity),
-        children(children_)
+        children(children_),
+        childBounds(bounds),
+        version(0)
     {}
 
     virtual ~Group() {}
@@ -0,0 +1,186 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#include "flatscene.h"
+
+using namespace std;
+
+void Shape::Flatten(FlatScene& scene, int parent)
+{
+    scene.AddNode(parent, mat4f::identity, drawable->bounds, drawable.get());
+}
+
+void Group::Flatten(FlatScene& scene, int parent)
+{
+    unsigned int node = scene.AddNode(parent, transform, childBounds, NULL);
+    scene.AddGroup(this, node);
+    for(const NodePtr& child : children)
+        child->Flatten(scene, node);
+    scene.subtreeEnd[node] = scene.parent.size();
+}
+
+unsigned int FlatScene::AddNode(int parent_, const mat4f& local_, const box& localBounds_, Drawable *drawable)
+{
+    unsigned int node = parent.size();
+    parent.push_back(parent_);
+    subtreeEnd.push_back(node + 1);
+    local.push_back(local_);
+    world.push_back(local_);
+    localBounds.push_back(localBounds_);
+    worldBounds.push_back(localBounds_);
+    drawables.push_back(drawable);
+    dirty.push_back(1);
+    return node;
+}
+
+void FlatScene::AddGroup(Group *group, unsigned int node)
+{
+    GroupSource g;
+    g.group = group;
+    g.node = node;
+    g.version = group->version;
+    groups.push_back(g);
+}
+
+void FlatScene::Build(const NodePtr& root)
+{
+    parent.clear();
+    subtreeEnd.clear();
+    local.clear();
+    world.clear();
+    localBounds.clear();
+    worldBounds.clear();
+    drawables.clear();
+    dirty.clear();
+    groups.clear();
+
+    root->Flatten(*this, -1);
+    version++;
+}
+
+void FlatScene::UpdateSubtree(unsigned int root)
+{
+    for(unsigned int i = root; i < subtreeEnd[root]; i++) {
+        int p = parent[i];
+        if(p < 0)
+            world[i] = mat4f::identity;
+        else if(drawables[i] != NULL)
+            world[i] = world[p]; // Shapes have no transform of their own
+        else
+            world[i] = local[i] * world[p];
+        worldBounds[i] = localBounds[i] * world[i];
+        dirty[i] = 0;
+    }
+}
+
+void FlatScene::RefitAncestors(unsigned int node)
+{
+    for(int p = parent[node]; p >= 0; p = parent[p]) {
+        box b;
+        for(unsigned int c = p + 1; c < subtreeEnd[p]; c = subtreeEnd[c])
+            b.extend(localBounds[c] * local[c]);
+        localBounds[p] = b;
+        worldBounds[p] = localBounds[p] * world[p];
+    }
+}
+
+void FlatScene::Update()
+{
+    bool changed = false;
+
+    for(GroupSource& g : groups)
+        if(g.group->version != g.version) {
+            local[g.node] = g.group->transform;
+            if(g.node != 0)
+                dirty[g.node] = 1;
+            g.version = g.group->version;
+            changed = true;
+        }
+
+    unsigned int i = 0;
+    while(i < parent.size()) {
+        if(dirty[i]) {
+            UpdateSubtree(i);
+            if(i != 0)
+                RefitAncestors(i);
+            i = subtreeEnd[i];
+            changed = true;
+        } else
+            i++;
+    }
+
+    if(changed)
+        version++;
+}
+
+void FlatScene::Visit(const Environment& env, DisplayList& displaylist)
+{
+    if(parent.empty())
+        return;
+
+    mat4f m = local[0] * env.modelview;
+
+    // Move the eye-space planes into root space so cached world bounds
+    // can be tested directly: p . (x * m) = x . (m p)
+    vec4f planes[6];
+    if(env.frustum != NULL)
+        for(int k = 0; k < 6; k++)
+            for(int r = 0; r < 4; r++)
+                planes[k][r] = vec_dot(vec4f(m.m_v + r * 4), env.frustum[k]);
+
+    cullStack.clear();
+    unsigned int i = 0;
+    while(i < parent.size()) {
+        while(!cullStack.empty() && i >= cullStack.back().end)
+            cullStack.pop_back();
+
+        unsigned int active = cullStack.empty() ? env.cullPlanes : cullStack.back().planes;
+
+        if(env.frustum != NULL && active != 0) {
+            if(worldBounds[i].is_empty()) {
+                i = subtreeEnd[i];
+                continue;
+            }
+
+            bool outside = false;
+            for(int k = 0; k < 6 && !outside; k++) {
+                if(!(active & (1u << k)))
+                    continue;
+                int side = box_plane_side(worldBounds[i], planes[k]);
+                if(side < 0)
+                    outside = true;
+                else if(side > 0)
+                    active &= ~(1u << k);
+            }
+            if(outside) {
+                i = subtreeEnd[i];
+                continue;
+            }
+        }
+
+        if(drawables[i] != NULL)
+            displaylist.Add(world[i] * m, env.projection, drawables[i]);
+        else if(subtreeEnd[i] > i + 1) {
+            CullState c;
+            c.end = subtreeEnd[i];
+            c.planes = active;
+            cullStack.push_back(c);
+        }
+
+        i++;
+    }
+}
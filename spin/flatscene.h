@@ -0,0 +1,86 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#ifndef _FLATSCENE_H_
+#define _FLATSCENE_H_
+
+#include <vector>
+#include "drawable.h"
+
+//
+// The Node graph compiled into contiguous arrays for traversal.  Nodes are
+// stored in depth-first preorder, so a node's parent precedes it and its
+// subtree is the range [i, subtreeEnd[i]).  A Node reached by more than
+// one path appears once per path.
+//
+// World transforms and bounds are cached; Update() copies in the
+// transforms of Groups whose version changed, recomputes only the
+// subtrees under them, and refits the bounds of their ancestors so
+// hierarchical culling stays correct.  Build() again if the graph's
+// structure changes.
+//
+// world[] and worldBounds[] are relative to the root's space; the root's
+// own transform, local[0], is applied by Visit.  A change to only the
+// root (the usual manipulator drag) therefore recomputes no world
+// transforms or bounds here, though it still bumps version.
+//
+struct FlatScene
+{
+    std::vector<int> parent; // -1 for the root
+    std::vector<unsigned int> subtreeEnd;
+    std::vector<mat4f> local; // identity for Shapes
+    std::vector<mat4f> world; // local * world[parent]; identity for the root
+    std::vector<box> localBounds; // below the node's own transform
+    std::vector<box> worldBounds;
+    std::vector<Drawable*> drawables; // NULL for Groups; owned by the graph
+    std::vector<unsigned char> dirty; // local changed since Update()
+
+    // Groups whose transform is mirrored in local[node]
+    struct GroupSource
+    {
+        Group *group;
+        unsigned int node;
+        unsigned int version;
+    };
+    std::vector<GroupSource> groups;
+
+    // Incremented when Build() or Update() changes anything Visit() reads
+    unsigned int version;
+
+    FlatScene() :
+        version(0)
+    {}
+
+    void Build(const NodePtr& root);
+    unsigned int AddNode(int parent, const mat4f& local, const box& localBounds, Drawable *drawable);
+    void AddGroup(Group *group, unsigned int node);
+    void Update();
+    void Visit(const Environment& env, DisplayList& displaylist);
+
+private:
+    struct CullState
+    {
+        unsigned int end;
+        unsigned int planes;
+    };
+    std::vector<CullState> cullStack; // kept to reuse its storage
+
+    void UpdateSubtree(unsigned int root);
+    void RefitAncestors(unsigned int node);
+};
+
+#endif /* _FLATSCENE_H_ */
@@ -0,0 +1,66 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+#include <cstddef>
+#include <vector>
+#include "floatshape.h"
+#include "compactvertex.h"
+#include "meshoptimize.h"
+#include "meshcache.h"
+
+using namespace std;
+
+void OptimizeFloatMesh(FloatVertex *vertices, size_t vertexCount, unsigned int *indices, size_t indexCount,
+    const function<void(FloatVertex *vertices, size_t vertexCount, unsigned int *indices, size_t indexCount)>& piece)
+{
+    if(vertexCount > SHORT_INDEXED_VERTICES) {
+        for(MeshChunk& c : SplitMesh(vertices, sizeof(FloatVertex), offsetof(FloatVertex, v), vertexCount, indices, indexCount, SHORT_INDEXED_VERTICES))
+            OptimizeFloatMesh((FloatVertex *)c.vertices.data(), c.vertexCount, c.indices.data(), c.indices.size(), piece);
+        return;
+    }
+
+    vertexCount = OptimizeMesh(vertices, sizeof(FloatVertex), offsetof(FloatVertex, v), vertexCount, indices, indexCount);
+    piece(vertices, vertexCount, indices, indexCount);
+}
+
+NodePtr MakeFloatShape(PhongShader::MaterialPtr mtl, FloatVertex *vertices, size_t vertexCount, unsigned int *indices, size_t indexCount, bool textured)
+{
+    vector<NodePtr> pieces;
+
+    OptimizeFloatMesh(vertices, vertexCount, indices, indexCount,
+        [&](FloatVertex *v, size_t count, unsigned int *pieceIndices, size_t pieceIndexCount) {
+            DrawListPtr drawlist(new DrawList);
+            drawlist->prims.push_back(DrawList::PrimInfo(GL_TRIANGLES, 0, pieceIndexCount));
+
+            box bounds;
+            bounds.extend(v[0].v, sizeof(FloatVertex), count);
+
+            if(gCompactVertices)
+                PlaceCompact(*drawlist, bounds, v[0].v, v[0].n, v[0].c, textured ? v[0].t : NULL, sizeof(FloatVertex), count, pieceIndices, pieceIndexCount);
+            else
+                GeometryPool::Get(FloatVertexFormat()).Place(*drawlist, v, count, pieceIndices, pieceIndexCount);
+
+            DrawablePtr drawable(new PhongShadedGeometry(drawlist, mtl, bounds));
+            if(gMeshRecorder)
+                gMeshRecorder->AddShape(drawable.get(), *mtl, v[0].v, v[0].n, v[0].c, textured ? v[0].t : NULL, sizeof(FloatVertex), count, pieceIndices, pieceIndexCount);
+            pieces.push_back(ShapePtr(new Shape(drawable)));
+        });
+
+    // Larger meshes become a Group of pieces with 16-bit indices
+    if(pieces.size() == 1)
+        return pieces[0];
+    return GroupPtr(new Group(mat4f::identity, pieces));
+}
@@ -0,0 +1,37 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+#ifndef _FLOATSHAPE_H_
+#define _FLOATSHAPE_H_
+
+#include <cstddef>
+#include <functional>
+#include "drawable.h"
+#include "geometrypool.h"
+#include "phongshader.h"
+
+// Split a GL_TRIANGLES mesh of FloatVertex into pieces small enough for
+// 16-bit indices, optimize each in place with OptimizeMesh, and pass each
+// piece's vertices and indices to piece.  Split pieces are copies.
+void OptimizeFloatMesh(FloatVertex *vertices, size_t vertexCount, unsigned int *indices, size_t indexCount,
+    const std::function<void(FloatVertex *vertices, size_t vertexCount, unsigned int *indices, size_t indexCount)>& piece);
+
+// Make a Shape of each OptimizeFloatMesh piece, grouped if there are
+// several, stored with PlaceCompact or in the FloatVertexFormat pool and
+// reported to gMeshRecorder.  Texcoords are dropped unless textured.
+NodePtr MakeFloatShape(PhongShader::MaterialPtr mtl, FloatVertex *vertices, size_t vertexCount, unsigned int *indices, size_t indexCount, bool textured);
+
+#endif /* _FLOATSHAPE_H_ */
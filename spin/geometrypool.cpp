@@ -0,0 +1,295 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+#include <algorithm>
+#include <cstring>
+#include "geometrypool.h"
+#include "glstate.h"
+#include "phongshader.h"
+
+using namespace std;
+
+// Default block capacities; larger meshes get a block of their own size
+static const size_t BLOCK_VERTEX_BYTES = 32 * 1024 * 1024;
+static const size_t BLOCK_INDEX_UNITS = 8 * 1024 * 1024;
+
+void VertexFormat::Add(GLuint location, GLint size, GLenum type, GLboolean normalized, size_t offset)
+{
+    Attribute a;
+    a.location = location;
+    a.size = size;
+    a.type = type;
+    a.normalized = normalized;
+    a.offset = offset;
+    attributes.push_back(a);
+}
+
+bool VertexFormat::operator==(const VertexFormat& other) const
+{
+    if(stride != other.stride || attributes.size() != other.attributes.size())
+        return false;
+    for(size_t i = 0; i < attributes.size(); i++) {
+        const Attribute& a = attributes[i];
+        const Attribute& b = other.attributes[i];
+        if(a.location != b.location || a.size != b.size || a.type != b.type ||
+            a.normalized != b.normalized || a.offset != b.offset)
+            return false;
+    }
+    return true;
+}
+
+const VertexFormat& FloatVertexFormat()
+{
+    static VertexFormat format(sizeof(FloatVertex));
+    if(format.attributes.empty()) {
+        format.Add(PhongShader::POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, offsetof(FloatVertex, v));
+        format.Add(PhongShader::NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, offsetof(FloatVertex, n));
+        format.Add(PhongShader::COLOR_LOCATION, 4, GL_FLOAT, GL_FALSE, offsetof(FloatVertex, c));
+        format.Add(PhongShader::TEXCOORD_LOCATION, 2, GL_FLOAT, GL_FALSE, offsetof(FloatVertex, t));
+    }
+    return format;
+}
+
+FreeList::FreeList(size_t capacity_) :
+    capacity(capacity_)
+{
+    if(capacity > 0)
+        free[0] = capacity;
+}
+
+size_t FreeList::Allocate(size_t size, size_t alignment)
+{
+    if(size == 0)
+        return 0;
+
+    for(auto it = free.begin(); it != free.end(); it++) {
+        size_t offset = it->first;
+        size_t padding = (alignment - offset % alignment) % alignment;
+        if(it->second >= padding + size) {
+            size_t remaining = it->second - padding - size;
+            free.erase(it);
+            if(padding > 0)
+                free[offset] = padding;
+            if(remaining > 0)
+                free[offset + padding + size] = remaining;
+            return offset + padding;
+        }
+    }
+    return npos;
+}
+
+void FreeList::Free(size_t offset, size_t size)
+{
+    if(size == 0)
+        return;
+
+    auto next = free.lower_bound(offset);
+    if(next != free.end() && offset + size == next->first) {
+        size += next->second;
+        next = free.erase(next);
+    }
+    if(next != free.begin()) {
+        auto prev = next;
+        prev--;
+        if(prev->first + prev->second == offset) {
+            prev->second += size;
+            return;
+        }
+    }
+    free[offset] = size;
+}
+
+GeometryRange::~GeometryRange()
+{
+    pool->Free(*this);
+}
+
+void GeometryPool::AddBlock(size_t vertexCapacity, size_t indexUnitCapacity)
+{
+    blocks.push_back(Block(vertexCapacity, indexUnitCapacity));
+    Block& b = blocks.back();
+
+    glGenVertexArrays(1, &b.vertexArray);
+    gGLState.BindVertexArray(b.vertexArray);
+
+    glGenBuffers(1, &b.vertexBuffer);
+    gGLState.BindBuffer(GL_ARRAY_BUFFER, b.vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, format.stride * vertexCapacity, NULL, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &b.indexBuffer);
+    gGLState.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, b.indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * indexUnitCapacity, NULL, GL_STATIC_DRAW);
+    CheckOpenGL(__FILE__, __LINE__);
+
+    for(const VertexFormat::Attribute& a : format.attributes) {
+        glVertexAttribPointer(a.location, a.size, a.type, a.normalized, format.stride, (void*)a.offset);
+        glEnableVertexAttribArray(a.location);
+    }
+    CheckOpenGL(__FILE__, __LINE__);
+
+    gGLState.BindVertexArray(GL_NONE);
+}
+
+void GeometryPool::Place(DrawList& dl, const void *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount)
+{
+    if(vertexCount > SHORT_INDEXED_VERTICES) {
+        Place(dl, vertices, vertexCount, indices, GL_UNSIGNED_INT, indexCount);
+        return;
+    }
+
+    // Narrowed as they're written rather than into a copy first
+    Allocate(dl, vertexCount, GL_UNSIGNED_SHORT, indexCount);
+    do {
+        void *mappedVertices, *mappedIndices;
+        Map(dl, mappedVertices, mappedIndices);
+        if(vertexCount > 0)
+            memcpy(mappedVertices, vertices, format.stride * vertexCount);
+        unsigned short *shortIndices = (unsigned short *)mappedIndices;
+        for(size_t i = 0; i < indexCount; i++)
+            shortIndices[i] = indices[i];
+    } while(!Unmap(dl));
+}
+
+void GeometryPool::Place(DrawList& dl, const void *vertices, size_t vertexCount, const void *indices, GLenum indexType, size_t indexCount)
+{
+    Allocate(dl, vertexCount, indexType, indexCount);
+
+    const GeometryRange& r = *dl.geometry;
+    Block& b = blocks[r.block];
+
+    gGLState.BindBuffer(GL_ARRAY_BUFFER, b.vertexBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, format.stride * r.firstVertex, format.stride * vertexCount, vertices);
+    gGLState.BindBuffer(GL_ARRAY_BUFFER, GL_NONE);
+
+    // The element binding is vertex array state; don't disturb another's
+    gGLState.BindVertexArray(b.vertexArray);
+    if(indexCount > 0)
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * r.firstIndexUnit, sizeof(unsigned short) * r.indexUnits, indices);
+    gGLState.BindVertexArray(GL_NONE);
+    CheckOpenGL(__FILE__, __LINE__);
+}
+
+void GeometryPool::Allocate(DrawList& dl, size_t vertexCount, GLenum indexType, size_t indexCount)
+{
+    size_t indexSize = (indexType == GL_UNSIGNED_SHORT) ? 1 : 2; // in units
+    size_t indexUnits = indexCount * indexSize;
+
+    unsigned int block = 0;
+    size_t firstVertex = FreeList::npos;
+    size_t firstIndexUnit = 0;
+
+    for(; block < blocks.size(); block++) {
+        Block& b = blocks[block];
+        firstVertex = b.vertices.Allocate(vertexCount);
+        if(firstVertex == FreeList::npos)
+            continue;
+        firstIndexUnit = b.indexUnits.Allocate(indexUnits, indexSize);
+        if(firstIndexUnit != FreeList::npos)
+            break;
+        b.vertices.Free(firstVertex, vertexCount);
+        firstVertex = FreeList::npos;
+    }
+
+    if(firstVertex == FreeList::npos) {
+        AddBlock(max(vertexCount, BLOCK_VERTEX_BYTES / format.stride), max(indexUnits, BLOCK_INDEX_UNITS));
+        block = blocks.size() - 1;
+        firstVertex = blocks[block].vertices.Allocate(vertexCount);
+        firstIndexUnit = blocks[block].indexUnits.Allocate(indexUnits, indexSize);
+    }
+
+    GeometryRange *range = new GeometryRange;
+    range->pool = this;
+    range->block = block;
+    range->firstVertex = firstVertex;
+    range->vertexCount = vertexCount;
+    range->firstIndexUnit = firstIndexUnit;
+    range->indexUnits = indexUnits;
+    dl.geometry = shared_ptr<GeometryRange>(range);
+
+    dl.vertexArray = blocks[block].vertexArray;
+    dl.baseVertex = firstVertex;
+    dl.indexed = indexCount > 0;
+    dl.indexType = dl.indexed ? indexType : GL_NONE;
+    if(dl.indexed)
+        for(DrawList::PrimInfo& p : dl.prims)
+            p.start += firstIndexUnit / indexSize;
+}
+
+void GeometryPool::Map(const DrawList& dl, void *&vertices, void *&indices)
+{
+    const GeometryRange& r = *dl.geometry;
+    Block& b = blocks[r.block];
+    // Nothing else in the block is disturbed, and nothing is drawn from
+    // it until Unmap, so the driver needn't preserve or wait for the range
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+
+    vertices = NULL;
+    if(r.vertexCount > 0) {
+        gGLState.BindBuffer(GL_ARRAY_BUFFER, b.vertexBuffer);
+        vertices = glMapBufferRange(GL_ARRAY_BUFFER, format.stride * r.firstVertex, format.stride * r.vertexCount, access);
+        gGLState.BindBuffer(GL_ARRAY_BUFFER, GL_NONE);
+    }
+
+    indices = NULL;
+    if(r.indexUnits > 0) {
+        gGLState.BindVertexArray(b.vertexArray);
+        indices = glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * r.firstIndexUnit, sizeof(unsigned short) * r.indexUnits, access);
+        gGLState.BindVertexArray(GL_NONE);
+    }
+    CheckOpenGL(__FILE__, __LINE__);
+}
+
+bool GeometryPool::Unmap(const DrawList& dl)
+{
+    const GeometryRange& r = *dl.geometry;
+    Block& b = blocks[r.block];
+    bool kept = true;
+
+    if(r.vertexCount > 0) {
+        gGLState.BindBuffer(GL_ARRAY_BUFFER, b.vertexBuffer);
+        kept = glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+        gGLState.BindBuffer(GL_ARRAY_BUFFER, GL_NONE);
+    }
+
+    if(r.indexUnits > 0) {
+        gGLState.BindVertexArray(b.vertexArray);
+        kept = (glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER) == GL_TRUE) && kept;
+        gGLState.BindVertexArray(GL_NONE);
+    }
+    CheckOpenGL(__FILE__, __LINE__);
+
+    return kept;
+}
+
+void GeometryPool::Free(const GeometryRange& range)
+{
+    Block& b = blocks[range.block];
+    b.vertices.Free(range.firstVertex, range.vertexCount);
+    b.indexUnits.Free(range.firstIndexUnit, range.indexUnits);
+}
+
+GeometryPool& GeometryPool::Get(const VertexFormat& format)
+{
+    // Pools outlive any DrawList, even ones destroyed after main returns
+    static vector<GeometryPool*> *pools = new vector<GeometryPool*>;
+
+    for(GeometryPool *pool : *pools)
+        if(pool->format == format)
+            return *pool;
+
+    pools->push_back(new GeometryPool(format));
+    return *pools->back();
+}
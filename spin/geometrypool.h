@@ -0,0 +1,160 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+#ifndef _GEOMETRYPOOL_H_
+#define _GEOMETRYPOOL_H_
+
+#include <cstddef>
+#include <vector>
+#include <map>
+#include <memory>
+
+#include "drawable.h"
+
+//
+// Vertex layout of a pool's buffers.  Attribute locations must be the
+// same in every program drawing from the pool; PhongShader binds them
+// before linking.
+//
+struct VertexFormat
+{
+    struct Attribute
+    {
+        GLuint location;
+        GLint size;
+        GLenum type;
+        GLboolean normalized;
+        size_t offset;
+    };
+    size_t stride;
+    std::vector<Attribute> attributes;
+
+    VertexFormat(size_t stride_) :
+        stride(stride_)
+    {}
+
+    void Add(GLuint location, GLint size, GLenum type, GLboolean normalized, size_t offset);
+    bool operator==(const VertexFormat& other) const;
+};
+
+//
+// First-fit allocator of ranges of [0, capacity); freed ranges merge
+// with free neighbors.  Allocated offsets are multiples of alignment.
+//
+struct FreeList
+{
+    static const size_t npos = ~(size_t)0;
+
+    size_t capacity;
+    std::map<size_t, size_t> free; // offset to size
+
+    FreeList(size_t capacity_);
+    size_t Allocate(size_t size, size_t alignment = 1); // offset or npos
+    void Free(size_t offset, size_t size);
+};
+
+// Vertex of floats the loaders build shapes from, stored in pools with
+// FloatVertexFormat(); untextured shapes leave t unused
+struct FloatVertex
+{
+    float v[3];
+    float n[3];
+    float c[4];
+    float t[2];
+};
+
+const VertexFormat& FloatVertexFormat();
+
+struct GeometryPool;
+
+// Place stores indices as GL_UNSIGNED_SHORT for up to this many vertices
+const size_t SHORT_INDEXED_VERTICES = 65536;
+
+// Vertices and indices of one DrawList within a pool; returned to the
+// pool on destruction.
+struct GeometryRange
+{
+    GeometryPool *pool;
+    unsigned int block;
+    size_t firstVertex;
+    size_t vertexCount;
+    size_t firstIndexUnit; // in 2-byte units, see GeometryPool
+    size_t indexUnits;
+
+    ~GeometryRange();
+};
+
+//
+// Large vertex and index buffers for one VertexFormat, each block with
+// its own vertex array, sub-allocated to DrawLists.  Drawing from one
+// pool needs a vertex array switch only between blocks, and DrawLists in
+// the same block can be submitted together with base vertices.
+//
+// A block's index buffer holds both GL_UNSIGNED_SHORT and GL_UNSIGNED_INT
+// indices, since the type is given per draw; it is allocated in 2-byte
+// units, aligned to 2 units for GL_UNSIGNED_INT.
+//
+struct GeometryPool
+{
+    struct Block
+    {
+        GLuint vertexArray;
+        GLuint vertexBuffer;
+        GLuint indexBuffer;
+        FreeList vertices;
+        FreeList indexUnits;
+
+        Block(size_t vertexCapacity, size_t indexUnitCapacity) :
+            vertices(vertexCapacity),
+            indexUnits(indexUnitCapacity)
+        {}
+    };
+
+    VertexFormat format;
+    std::vector<Block> blocks;
+
+    // Copy vertices and indices into the pool and point dl at them.
+    // dl's prims are given relative to indices, or to vertices if
+    // indexCount is 0, and are adjusted to the pool's buffers.  Indices
+    // are stored as GL_UNSIGNED_SHORT if vertexCount allows.
+    void Place(DrawList& dl, const void *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount);
+
+    // The same with indices already of indexType, uploaded as they are
+    void Place(DrawList& dl, const void *vertices, size_t vertexCount, const void *indices, GLenum indexType, size_t indexCount);
+
+    // For loaders that write vertices and indices in place rather than
+    // building them to be copied: Allocate storage and point dl at it as
+    // Place would, then Map it and write all of it.  Unmap before drawing
+    // from the pool; it returns false if the contents were lost and must
+    // be mapped and written again.
+    void Allocate(DrawList& dl, size_t vertexCount, GLenum indexType, size_t indexCount);
+    void Map(const DrawList& dl, void *&vertices, void *&indices); // write only
+    bool Unmap(const DrawList& dl);
+
+    void Free(const GeometryRange& range);
+
+    // The pool for format, created on first use and never destroyed
+    static GeometryPool& Get(const VertexFormat& format);
+
+private:
+    GeometryPool(const VertexFormat& format_) :
+        format(format_)
+    {}
+
+    void AddBlock(size_t vertexCapacity, size_t indexUnitCapacity);
+};
+
+#endif /* _GEOMETRYPOOL_H_ */
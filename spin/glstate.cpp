@@ -0,0 +1,182 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+#include <cstring>
+#include "glstate.h"
+
+GLStateCache gGLState;
+
+GLStateCache::GLStateCache() :
+    issued(0),
+    elided(0)
+{
+    Invalidate();
+}
+
+void GLStateCache::Invalidate()
+{
+    program = UNKNOWN;
+    vertexArray = UNKNOWN;
+    arrayBuffer = UNKNOWN;
+    elementArrayBuffer = UNKNOWN;
+    textureBuffer = UNKNOWN;
+    activeUnit = UNKNOWN;
+    for(int i = 0; i < TEXTURE_UNITS; i++) {
+        textures2D[i] = UNKNOWN;
+        texturesBuffer[i] = UNKNOWN;
+    }
+    for(int i = 0; i < UNIFORM_BINDINGS; i++)
+        uniformRanges[i].buffer = UNKNOWN;
+}
+
+void GLStateCache::ResetCounters()
+{
+    issued = 0;
+    elided = 0;
+}
+
+// Record value and return true if the call setting it must be made
+bool GLStateCache::Changed(GLuint& cached, GLuint value)
+{
+    if(cached == value) {
+        elided++;
+        return false;
+    }
+    cached = value;
+    issued++;
+    return true;
+}
+
+void GLStateCache::UseProgram(GLuint program_)
+{
+    if(Changed(program, program_))
+        glUseProgram(program_);
+}
+
+void GLStateCache::BindVertexArray(GLuint vertexArray_)
+{
+    if(Changed(vertexArray, vertexArray_)) {
+        glBindVertexArray(vertexArray_);
+        elementArrayBuffer = UNKNOWN;
+    }
+}
+
+void GLStateCache::BindBuffer(GLenum target, GLuint buffer)
+{
+    GLuint *cached = NULL;
+    switch(target) {
+        case GL_ARRAY_BUFFER: cached = &arrayBuffer; break;
+        case GL_ELEMENT_ARRAY_BUFFER: cached = &elementArrayBuffer; break;
+        case GL_TEXTURE_BUFFER: cached = &textureBuffer; break;
+    }
+
+    if(cached == NULL) {
+        issued++;
+        glBindBuffer(target, buffer);
+    } else if(Changed(*cached, buffer))
+        glBindBuffer(target, buffer);
+}
+
+GLuint *GLStateCache::TextureBinding(GLuint unit, GLenum target)
+{
+    if(unit >= (GLuint)TEXTURE_UNITS)
+        return NULL;
+    if(target == GL_TEXTURE_2D)
+        return &textures2D[unit];
+    if(target == GL_TEXTURE_BUFFER)
+        return &texturesBuffer[unit];
+    return NULL;
+}
+
+void GLStateCache::BindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    GLuint *cached = TextureBinding(unit, target);
+    if(cached != NULL && *cached == texture) {
+        elided++;
+        return;
+    }
+
+    if(Changed(activeUnit, unit))
+        glActiveTexture(GL_TEXTURE0 + unit);
+    issued++;
+    glBindTexture(target, texture);
+    if(cached != NULL)
+        *cached = texture;
+}
+
+void GLStateCache::BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    if(target == GL_UNIFORM_BUFFER && index < (GLuint)UNIFORM_BINDINGS) {
+        BufferRange& r = uniformRanges[index];
+        if(r.buffer == buffer && r.offset == offset && r.size == size) {
+            elided++;
+            return;
+        }
+        r.buffer = buffer;
+        r.offset = offset;
+        r.size = size;
+    }
+    issued++;
+    glBindBufferRange(target, index, buffer, offset, size);
+}
+
+bool GLStateCache::UniformChanged(GLint location, const void *value, int count)
+{
+    if(location == -1) {
+        elided++;
+        return false;
+    }
+
+    // An unknown program has no usable cached values
+    if(program == UNKNOWN) {
+        issued++;
+        return true;
+    }
+
+    UniformValue& u = uniforms[((uint64_t)program << 32) | (uint32_t)location];
+    if(u.count == count && memcmp(u.bits, value, count * 4) == 0) {
+        elided++;
+        return false;
+    }
+    u.count = count;
+    memcpy(u.bits, value, count * 4);
+    issued++;
+    return true;
+}
+
+void GLStateCache::Uniform1i(GLint location, GLint value)
+{
+    if(UniformChanged(location, &value, 1))
+        glUniform1i(location, value);
+}
+
+void GLStateCache::Uniform1f(GLint location, GLfloat value)
+{
+    if(UniformChanged(location, &value, 1))
+        glUniform1f(location, value);
+}
+
+void GLStateCache::Uniform4fv(GLint location, const GLfloat *value)
+{
+    if(UniformChanged(location, value, 4))
+        glUniform4fv(location, 1, value);
+}
+
+void GLStateCache::UniformMatrix4fv(GLint location, const GLfloat *value)
+{
+    if(UniformChanged(location, value, 16))
+        glUniformMatrix4fv(location, 1, GL_FALSE, value);
+}
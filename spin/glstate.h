@@ -0,0 +1,97 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+#ifndef _GLSTATE_H_
+#define _GLSTATE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+#define GLFW_INCLUDE_GLCOREARB
+#include <GLFW/glfw3.h>
+
+//
+// Shadow of the GL state the renderer sets, so that calls which wouldn't
+// change it are skipped.  Code drawing through the cache must make these
+// calls only through it; Invalidate() forgets bindings when other code
+// may have changed them.  Uniform values are per program and are kept,
+// since only glUniform changes them.
+//
+// The element array binding belongs to the vertex array, so it is
+// forgotten whenever the vertex array changes.  The generic
+// GL_UNIFORM_BUFFER binding is not tracked, since binding a range also
+// changes it.
+//
+struct GLStateCache
+{
+    size_t issued; // GL calls made
+    size_t elided; // calls skipped as redundant
+
+    void UseProgram(GLuint program);
+    void BindVertexArray(GLuint vertexArray);
+    void BindBuffer(GLenum target, GLuint buffer);
+    void BindTexture(GLuint unit, GLenum target, GLuint texture);
+    void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+    // Set uniforms of the current program
+    void Uniform1i(GLint location, GLint value);
+    void Uniform1f(GLint location, GLfloat value);
+    void Uniform4fv(GLint location, const GLfloat *value);
+    void UniformMatrix4fv(GLint location, const GLfloat *value); // not transposed
+
+    void Invalidate();
+    void ResetCounters();
+
+    GLStateCache();
+
+private:
+    static const GLuint UNKNOWN = ~0u;
+    static const int TEXTURE_UNITS = 8;
+    static const int UNIFORM_BINDINGS = 8;
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint arrayBuffer;
+    GLuint elementArrayBuffer;
+    GLuint textureBuffer;
+    GLuint activeUnit;
+    GLuint textures2D[TEXTURE_UNITS];
+    GLuint texturesBuffer[TEXTURE_UNITS];
+
+    struct BufferRange
+    {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+    BufferRange uniformRanges[UNIFORM_BINDINGS];
+
+    struct UniformValue
+    {
+        int count;
+        uint32_t bits[16];
+    };
+    std::unordered_map<uint64_t, UniformValue> uniforms; // by program, location
+
+    bool Changed(GLuint& cached, GLuint value);
+    bool UniformChanged(GLint location, const void *value, int count);
+    GLuint *TextureBinding(GLuint unit, GLenum target);
+};
+
+extern GLStateCache gGLState;
+
+#endif /* _GLSTATE_H_ */
@@ -2,7 +2,9 @@
 #include "loader.h"
 #include "builtin_loader.h"
 #include "trisrc_loader.h"
+#include "trib_loader.h"
 #include "assimp_loader.h"
+#include "meshcache.h"
 #include "manipulator.h"
 
 using namespace std;
@@ -18,11 +20,15 @@ tuple<bool, NodePtr> LoadModel(const string& filename)
 
     } else if(extension == "trisrc") {
 
-        return TriSrcLoader::Load(filename);
+        return LoadCached(filename, TriSrcLoader::Load);
+
+    } else if(extension == "trib") {
+
+        return TribLoader::Load(filename);
 
     } else {
 
-        return AssimpLoader::Load(filename);
+        return LoadCached(filename, AssimpLoader::Load);
 
     // } else {
 
@@ -46,7 +52,7 @@ struct DefaultController : public Controller
         height(512), // XXX hm
         buttonPressed(-1)
     {
-        root->transform = manip.m_matrix;
+        root->SetTransform(manip.m_matrix);
     }
     virtual void Update(float time);
     virtual bool Key(int key, int scancode, int action, int mods);
@@ -66,7 +72,7 @@ void DefaultController::Update(float time)
 bool DefaultController::Scroll(double dx, double dy)
 {
     manip.move(dx / width, dy / height);
-    root->transform = manip.m_matrix;
+    root->SetTransform(manip.m_matrix);
     return false;
 }
 
@@ -74,7 +80,7 @@ bool DefaultController::Motion(double dx, double dy)
 {
     if(buttonPressed == 1) {
         manip.move(dx / width, dy / height);
-        root->transform = manip.m_matrix;
+        root->SetTransform(manip.m_matrix);
     }
     return false;
 }
@@ -108,22 +114,22 @@ bool DefaultController::Key(int key, int scancode, int action, int mods)
                 
             case 'R':
                 manip.m_mode = manipulator::ROTATE;
-                root->transform = manip.m_matrix;
+                root->SetTransform(manip.m_matrix);
                 break;
 
             case 'O':
                 manip.m_mode = manipulator::ROLL;
-                root->transform = manip.m_matrix;
+                root->SetTransform(manip.m_matrix);
                 break;
 
             case 'X':
                 manip.m_mode = manipulator::SCROLL;
-                root->transform = manip.m_matrix;
+                root->SetTransform(manip.m_matrix);
                 break;
 
             case 'Z':
                 manip.m_mode = manipulator::DOLLY;
-                root->transform = manip.m_matrix;
+                root->SetTransform(manip.m_matrix);
                 break;
         }
     }
@@ -0,0 +1,297 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <chrono>
+#include <vector>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "meshcache.h"
+#include "vertexweld.h"
+#include "trib_loader.h"
+
+using namespace std;
+
+MeshRecorder *gMeshRecorder = NULL;
+bool gUseMeshCache = true;
+
+// Change when loaders change what they make, so older entries miss
+static const uint32_t MESH_CACHE_VERSION = 1;
+
+void MeshRecorder::AddTexture(GLuint texture, const string& filename)
+{
+    // Cached files are elsewhere, so names must be absolute
+    char path[PATH_MAX];
+    if(realpath(filename.c_str(), path) != NULL)
+        textures[texture] = path;
+}
+
+static const float *Element(const float *first, size_t stride, size_t i)
+{
+    return (const float *)((const unsigned char *)first + stride * i);
+}
+
+bool MeshRecorder::AddMaterial(const PhongShader::Material& mtl, unsigned int& index)
+{
+    auto m = materials.find(mtl.id);
+    if(m != materials.end()) {
+        index = m->second;
+        return true;
+    }
+
+    string texture;
+    if(mtl.diffuseTexture != GL_NONE) {
+        auto t = textures.find(mtl.diffuseTexture);
+        if(t == textures.end())
+            return false;
+        texture = t->second;
+    }
+    if(!writer.AddMaterial(texture, &mtl.diffuse[0], &mtl.ambient[0], &mtl.specular[0], mtl.shininess, index))
+        return false;
+    materials.insert(make_pair(mtl.id, index));
+    return true;
+}
+
+void MeshRecorder::AddShape(const Drawable *drawable, const PhongShader::Material& mtl,
+    const float *positions, const float *normals, const float *colors,
+    const float *texcoords, size_t stride, size_t vertexCount,
+    const unsigned int *indices, size_t indexCount)
+{
+    if(!complete)
+        return;
+    unsigned int material;
+    if(!AddMaterial(mtl, material)) {
+        complete = false;
+        return;
+    }
+
+    vector<TribVertex> vertices(vertexCount);
+    for(size_t i = 0; i < vertexCount; i++) {
+        TribVertex& v = vertices[i];
+        memcpy(v.v, Element(positions, stride, i), sizeof(v.v));
+        memcpy(v.n, Element(normals, stride, i), sizeof(v.n));
+        memcpy(v.c, Element(colors, stride, i), sizeof(v.c));
+        if(texcoords != NULL)
+            memcpy(v.t, Element(texcoords, stride, i), sizeof(v.t));
+        else
+            v.t[0] = v.t[1] = 0;
+    }
+
+    shapes[drawable] = writer.AddShape(material, move(vertices), indices, indexCount);
+}
+
+void MeshRecorder::AddShape(const Drawable *drawable, const PhongShader::Material& mtl,
+    size_t vertexCount, const function<FloatVertex(size_t)>& vertex,
+    const unsigned int *indices, size_t indexCount)
+{
+    static_assert(sizeof(TribVertex) == sizeof(FloatVertex), "TribVertex must match FloatVertex");
+
+    if(!complete)
+        return;
+    unsigned int material;
+    if(!AddMaterial(mtl, material)) {
+        complete = false;
+        return;
+    }
+
+    vector<TribVertex> vertices(vertexCount);
+    for(size_t i = 0; i < vertexCount; i++) {
+        FloatVertex v = vertex(i);
+        memcpy(&vertices[i], &v, sizeof(v));
+    }
+
+    shapes[drawable] = writer.AddShape(material, move(vertices), indices, indexCount);
+}
+
+void MeshRecorder::AddNode(const NodePtr& node)
+{
+    if(ShapePtr shape = dynamic_pointer_cast<Shape>(node)) {
+        auto s = shapes.find(shape->drawable.get());
+        if(s == shapes.end())
+            complete = false;
+        else
+            writer.AddShapeNode(s->second);
+    } else if(GroupPtr group = dynamic_pointer_cast<Group>(node)) {
+        writer.AddGroup(group->transform.m_v, group->children.size());
+        for(const NodePtr& child : group->children)
+            AddNode(child);
+    } else {
+        complete = false;
+    }
+}
+
+bool MeshRecorder::Write(const NodePtr& root, const string& filename)
+{
+    AddNode(root);
+    if(!complete)
+        return false;
+    return writer.Write(filename);
+}
+
+// 64-bit hash of data, eight bytes at a time
+static uint64_t Hash(const void *data, size_t size, uint64_t h = 0x9e3779b97f4a7c15ull)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    const uint64_t k = 0xff51afd7ed558ccdull;
+
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        h = (h ^ word) * k;
+        h ^= h >> 32;
+    }
+
+    uint64_t last = 0;
+    memcpy(&last, bytes + i, size - i);
+    h = (h ^ last ^ size) * k;
+    h ^= h >> 32;
+    return h;
+}
+
+static bool GetCacheDirectory(string& directory)
+{
+    const char *env;
+    if((env = getenv("SPIN_CACHE_DIR")) != NULL && env[0] != '\0') {
+        directory = env;
+    } else if((env = getenv("XDG_CACHE_HOME")) != NULL && env[0] != '\0') {
+        directory = string(env) + "/spin";
+    } else if((env = getenv("HOME")) != NULL && env[0] != '\0') {
+        string cache = string(env) + "/.cache";
+        mkdir(cache.c_str(), 0755);
+        directory = cache + "/spin";
+    } else {
+        return false;
+    }
+    return mkdir(directory.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+static bool GetCacheFilename(const string& filename, string& cacheFilename)
+{
+    string directory;
+    if(!GetCacheDirectory(directory))
+        return false;
+
+    char path[PATH_MAX];
+    if(realpath(filename.c_str(), path) == NULL)
+        return false;
+
+    int fd = open(path, O_RDONLY);
+    if(fd == -1)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+        close(fd);
+        return false;
+    }
+
+    uint64_t contents = 0;
+    if(st.st_size > 0) {
+        void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+        contents = Hash(mapped, st.st_size);
+        munmap(mapped, st.st_size);
+    }
+    close(fd);
+
+    // -q isn't here; cached vertices are quantized as they're loaded
+    struct {
+        uint64_t size;
+        int64_t mtime;
+        uint64_t contents;
+        float weldEpsilon;
+        uint32_t tribVersion;
+        uint32_t cacheVersion;
+    } key;
+    memset(&key, 0, sizeof(key));
+    key.size = st.st_size;
+    key.mtime = st.st_mtime;
+    key.contents = contents;
+    key.weldEpsilon = gWeldEpsilon;
+    key.tribVersion = TRIB_VERSION;
+    key.cacheVersion = MESH_CACHE_VERSION;
+
+    uint64_t h = Hash(path, strlen(path), Hash(&key, sizeof(key)));
+
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.trib", (unsigned long long)h);
+    cacheFilename = directory + name;
+    return true;
+}
+
+static float SecondsSince(const chrono::time_point<chrono::system_clock>& then)
+{
+    chrono::duration<float> elapsed = chrono::system_clock::now() - then;
+    return elapsed.count();
+}
+
+tuple<bool, NodePtr> LoadCached(const string& filename, function<tuple<bool, NodePtr>(const string&)> load)
+{
+    chrono::time_point<chrono::system_clock> start = chrono::system_clock::now();
+
+    string cacheFilename;
+    if(!gUseMeshCache || !GetCacheFilename(filename, cacheFilename))
+        return load(filename);
+
+    bool success;
+    NodePtr root;
+
+    struct stat st;
+    if(stat(cacheFilename.c_str(), &st) == 0) {
+        tie(success, root) = TribLoader::Load(cacheFilename);
+        if(success) {
+            printf("mesh cache hit for \"%s\", loaded in %.3f seconds\n", filename.c_str(), SecondsSince(start));
+            return make_tuple(success, root);
+        }
+        fprintf(stderr, "discarding mesh cache entry \"%s\"\n", cacheFilename.c_str());
+        unlink(cacheFilename.c_str());
+    }
+
+    MeshRecorder recorder;
+    gMeshRecorder = &recorder;
+    tie(success, root) = load(filename);
+    gMeshRecorder = NULL;
+
+    if(!success)
+        return make_tuple(success, root);
+
+    float loaded = SecondsSince(start);
+    chrono::time_point<chrono::system_clock> writeStart = chrono::system_clock::now();
+
+    // Renamed into place so another spin never maps a partial file
+    string temporary = cacheFilename + "." + to_string(getpid());
+    bool cached = recorder.Write(root, temporary) && rename(temporary.c_str(), cacheFilename.c_str()) == 0;
+    if(!cached)
+        unlink(temporary.c_str());
+
+    printf("mesh cache miss for \"%s\", loaded in %.3f seconds, %s in %.3f seconds\n",
+        filename.c_str(), loaded, cached ? "cached" : "not cached", SecondsSince(writeStart));
+
+    return make_tuple(success, root);
+}
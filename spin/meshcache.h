@@ -0,0 +1,76 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#ifndef _MESHCACHE_H_
+#define _MESHCACHE_H_
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <functional>
+#include "drawable.h"
+#include "geometrypool.h"
+#include "phongshader.h"
+#include "trib.h"
+
+//
+// LoadModel keeps the scenes loaders make in .trib files under
+// $SPIN_CACHE_DIR, $XDG_CACHE_HOME/spin or ~/.cache/spin, named by a hash
+// of the model's path, size, modification time and contents and of the
+// options that change what loaders make.  A hit maps the .trib instead of
+// running the loader.
+//
+// On a miss, loaders report each Shape's final vertices, indices and
+// material to gMeshRecorder as they make it.  The scene is cached only if
+// every Shape in it was reported.
+//
+struct MeshRecorder
+{
+    // Textures must be reported by name to be cached
+    void AddTexture(GLuint texture, const std::string& filename);
+    // Vertices and indices as passed to PlaceCompact; texcoords may be NULL
+    void AddShape(const Drawable *drawable, const PhongShader::Material& mtl,
+        const float *positions, const float *normals, const float *colors,
+        const float *texcoords, size_t stride, size_t vertexCount,
+        const unsigned int *indices, size_t indexCount);
+    // For loaders that make vertices straight into a mapping; vertex(i)
+    // returns vertex i again
+    void AddShape(const Drawable *drawable, const PhongShader::Material& mtl,
+        size_t vertexCount, const std::function<FloatVertex(size_t)>& vertex,
+        const unsigned int *indices, size_t indexCount);
+    bool Write(const NodePtr& root, const std::string& filename);
+
+    MeshRecorder() :
+        complete(true)
+    {}
+
+private:
+    TribWriter writer;
+    std::map<GLuint, std::string> textures;
+    std::map<unsigned int, unsigned int> materials; // Material id to writer's
+    std::map<const Drawable*, unsigned int> shapes;
+    bool complete; // false once something couldn't be recorded
+    bool AddMaterial(const PhongShader::Material& mtl, unsigned int& index);
+    void AddNode(const NodePtr& node);
+};
+
+extern MeshRecorder *gMeshRecorder; // non-NULL while a cache miss loads
+extern bool gUseMeshCache;
+
+std::tuple<bool, NodePtr> LoadCached(const std::string& filename, std::function<std::tuple<bool, NodePtr>(const std::string&)> load);
+
+#endif /* _MESHCACHE_H_ */
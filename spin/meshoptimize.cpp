@@ -0,0 +1,462 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "meshoptimize.h"
+#include "vectormath.h"
+#include "geometry.h"
+
+using namespace std;
+
+bool gPrintMeshStatistics = false;
+
+VertexCacheStatistics AnalyzeVertexCache(const unsigned int *indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize)
+{
+    // A vertex is in the FIFO if fewer than cacheSize misses came after its own
+    vector<size_t> missedAt(vertexCount, 0);
+    size_t misses = 0;
+    size_t referenced = 0;
+
+    for(size_t i = 0; i < indexCount; i++) {
+        unsigned int v = indices[i];
+        if(missedAt[v] == 0)
+            referenced++;
+        if(missedAt[v] == 0 || misses - missedAt[v] >= cacheSize) {
+            misses++;
+            missedAt[v] = misses;
+        }
+    }
+
+    VertexCacheStatistics s;
+    s.acmr = (indexCount < 3) ? 0 : misses / (float)(indexCount / 3);
+    s.atvr = (referenced == 0) ? 0 : misses / (float)referenced;
+    return s;
+}
+
+// Forsyth, "Linear-Speed Vertex Cache Optimisation"
+static const int FORSYTH_CACHE_SIZE = 32;
+
+static float ForsythVertexScore(int cachePosition, unsigned int liveTriangles)
+{
+    if(liveTriangles == 0)
+        return -1;
+
+    float score = 0;
+    if(cachePosition >= 0) {
+        // The last triangle's vertices score the same, so it isn't reused
+        // in the order it was emitted
+        if(cachePosition < 3)
+            score = 0.75f;
+        else
+            score = powf(1.0f - (cachePosition - 3) / (float)(FORSYTH_CACHE_SIZE - 3), 1.5f);
+    }
+
+    // Favor vertices with few triangles left, to finish them off
+    return score + 2.0f / sqrtf((float)liveTriangles);
+}
+
+void OptimizeVertexCache(unsigned int *indices, size_t indexCount, size_t vertexCount)
+{
+    size_t triangleCount = indexCount / 3;
+    if(triangleCount == 0)
+        return;
+
+    // Triangles using each vertex; the first live[v] are not yet emitted
+    vector<size_t> adjacencyStart(vertexCount + 1, 0);
+    for(size_t i = 0; i < triangleCount * 3; i++)
+        adjacencyStart[indices[i] + 1]++;
+    for(size_t v = 0; v < vertexCount; v++)
+        adjacencyStart[v + 1] += adjacencyStart[v];
+    vector<unsigned int> live(vertexCount, 0);
+    vector<size_t> adjacency(triangleCount * 3);
+    for(size_t t = 0; t < triangleCount; t++)
+        for(int j = 0; j < 3; j++) {
+            unsigned int v = indices[t * 3 + j];
+            adjacency[adjacencyStart[v] + live[v]++] = t;
+        }
+
+    vector<int> cachePosition(vertexCount, -1);
+    vector<float> vertexScore(vertexCount);
+    for(size_t v = 0; v < vertexCount; v++)
+        vertexScore[v] = ForsythVertexScore(-1, live[v]);
+
+    vector<float> triangleScore(triangleCount);
+    vector<bool> emitted(triangleCount, false);
+    size_t best = 0;
+    for(size_t t = 0; t < triangleCount; t++) {
+        const unsigned int *tri = &indices[t * 3];
+        triangleScore[t] = vertexScore[tri[0]] + vertexScore[tri[1]] + vertexScore[tri[2]];
+        if(triangleScore[t] > triangleScore[best])
+            best = t;
+    }
+
+    vector<unsigned int> result(triangleCount * 3);
+    vector<unsigned int> cache, nextCache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    nextCache.reserve(FORSYTH_CACHE_SIZE + 3);
+    size_t nextUnemitted = 0;
+
+    for(size_t out = 0; out < triangleCount; out++) {
+        if(best == triangleCount) {
+            // Nothing in the cache has triangles left; start anywhere else
+            while(emitted[nextUnemitted])
+                nextUnemitted++;
+            best = nextUnemitted;
+        }
+
+        const unsigned int *tri = &indices[best * 3];
+        emitted[best] = true;
+        nextCache.clear();
+        for(int j = 0; j < 3; j++) {
+            unsigned int v = tri[j];
+            result[out * 3 + j] = v;
+            nextCache.push_back(v);
+
+            size_t *a = &adjacency[adjacencyStart[v]];
+            for(unsigned int k = 0; k < live[v]; k++)
+                if(a[k] == best) {
+                    a[k] = a[live[v] - 1];
+                    a[live[v] - 1] = best;
+                    break;
+                }
+            live[v]--;
+        }
+        for(unsigned int v : cache)
+            if(v != tri[0] && v != tri[1] && v != tri[2])
+                nextCache.push_back(v);
+        cache.swap(nextCache);
+
+        for(size_t i = 0; i < cache.size(); i++) {
+            unsigned int v = cache[i];
+            cachePosition[v] = (i < FORSYTH_CACHE_SIZE) ? i : -1;
+            vertexScore[v] = ForsythVertexScore(cachePosition[v], live[v]);
+        }
+
+        best = triangleCount;
+        float bestScore = -1;
+        for(unsigned int v : cache)
+            for(unsigned int k = 0; k < live[v]; k++) {
+                size_t t = adjacency[adjacencyStart[v] + k];
+                const unsigned int *u = &indices[t * 3];
+                triangleScore[t] = vertexScore[u[0]] + vertexScore[u[1]] + vertexScore[u[2]];
+                if(triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+
+        if(cache.size() > FORSYTH_CACHE_SIZE)
+            cache.resize(FORSYTH_CACHE_SIZE);
+    }
+
+    copy(result.begin(), result.end(), indices);
+}
+
+static unsigned int CacheMisses(const unsigned int *indices, size_t indexCount, vector<size_t>& missedAt, size_t& misses, unsigned int cacheSize)
+{
+    unsigned int count = 0;
+    for(size_t i = 0; i < indexCount; i++) {
+        unsigned int v = indices[i];
+        if(missedAt[v] == 0 || misses - missedAt[v] >= cacheSize) {
+            misses++;
+            missedAt[v] = misses;
+            count++;
+        }
+    }
+    return count;
+}
+
+void OptimizeOverdraw(unsigned int *indices, size_t indexCount, const float *positions, size_t stride, size_t vertexCount, float threshold)
+{
+    const unsigned int cacheSize = 16;
+    size_t triangleCount = indexCount / 3;
+    if(triangleCount < 2)
+        return;
+
+    // Hard boundaries where a triangle misses on all its vertices
+    vector<size_t> hard;
+    {
+        vector<size_t> missedAt(vertexCount, 0);
+        size_t misses = 0;
+        for(size_t t = 0; t < triangleCount; t++)
+            if(CacheMisses(&indices[t * 3], 3, missedAt, misses, cacheSize) == 3)
+                hard.push_back(t);
+    }
+    if(hard.empty() || hard[0] != 0)
+        hard.insert(hard.begin(), 0);
+    hard.push_back(triangleCount);
+
+    // Soft boundaries within those where a cold cache costs little more
+    vector<size_t> clusters;
+    for(size_t h = 0; h + 1 < hard.size(); h++) {
+        size_t start = hard[h], end = hard[h + 1];
+
+        vector<size_t> missedAt(vertexCount, 0);
+        size_t misses = 0;
+        float clusterACMR = CacheMisses(&indices[start * 3], (end - start) * 3, missedAt, misses, cacheSize) / (float)(end - start);
+
+        clusters.push_back(start);
+        fill(missedAt.begin(), missedAt.end(), 0);
+        misses = 0;
+        size_t softStart = start;
+        size_t softMisses = 0;
+        for(size_t t = start; t < end; t++) {
+            softMisses += CacheMisses(&indices[t * 3], 3, missedAt, misses, cacheSize);
+            if(t + 1 < end && softMisses / (float)(t + 1 - softStart) <= clusterACMR * threshold) {
+                clusters.push_back(t + 1);
+                fill(missedAt.begin(), missedAt.end(), 0);
+                misses = 0;
+                softStart = t + 1;
+                softMisses = 0;
+            }
+        }
+    }
+    clusters.push_back(triangleCount);
+
+    // Area-weighted center and normal of the mesh and of each cluster
+    vec3f meshCenter(0, 0, 0);
+    float meshArea = 0;
+    size_t clusterCount = clusters.size() - 1;
+    vector<vec3f> clusterCenter(clusterCount, vec3f(0, 0, 0));
+    vector<vec3f> clusterNormal(clusterCount, vec3f(0, 0, 0));
+    for(size_t c = 0; c < clusterCount; c++) {
+        float area = 0;
+        for(size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+            vec3f p[3];
+            for(int j = 0; j < 3; j++) {
+                const float *f = (const float *)((const unsigned char *)positions + stride * indices[t * 3 + j]);
+                p[j] = vec3f(f[0], f[1], f[2]);
+            }
+            vec3f n = vec_cross(p[1] - p[0], p[2] - p[0]);
+            float a = vec_length(n);
+            clusterCenter[c] += (p[0] + p[1] + p[2]) * (a / 3);
+            clusterNormal[c] += n;
+            area += a;
+        }
+        meshCenter += clusterCenter[c];
+        meshArea += area;
+        if(area > 0)
+            clusterCenter[c] /= area;
+    }
+    if(meshArea > 0)
+        meshCenter /= meshArea;
+
+    // Clusters facing away from the center are more likely to occlude the rest
+    vector<pair<float, size_t>> order(clusterCount);
+    for(size_t c = 0; c < clusterCount; c++) {
+        float l = vec_length(clusterNormal[c]);
+        float facing = (l > 0) ? vec_dot(clusterCenter[c] - meshCenter, clusterNormal[c]) / l : 0;
+        order[c] = make_pair(-facing, c);
+    }
+    stable_sort(order.begin(), order.end());
+
+    vector<unsigned int> result;
+    result.reserve(triangleCount * 3);
+    for(auto& o : order)
+        result.insert(result.end(), &indices[clusters[o.second] * 3], &indices[clusters[o.second + 1] * 3]);
+    copy(result.begin(), result.end(), indices);
+}
+
+size_t RemapVertexFetch(unsigned int *indices, size_t indexCount, size_t vertexCount, vector<unsigned int>& remap)
+{
+    remap.assign(vertexCount, UNUSED_VERTEX);
+    size_t used = 0;
+    for(size_t i = 0; i < indexCount; i++) {
+        unsigned int& r = remap[indices[i]];
+        if(r == UNUSED_VERTEX)
+            r = used++;
+        indices[i] = r;
+    }
+    return used;
+}
+
+size_t OptimizeVertexFetch(void *vertices, size_t vertexSize, size_t vertexCount, unsigned int *indices, size_t indexCount)
+{
+    vector<unsigned int> remap;
+    size_t used = RemapVertexFetch(indices, indexCount, vertexCount, remap);
+
+    // Unused vertices go after the used ones, making remap a permutation
+    // that can be followed around its cycles with one vertex of storage
+    size_t unused = used;
+    for(unsigned int& r : remap)
+        if(r == UNUSED_VERTEX)
+            r = unused++;
+
+    unsigned char *v = (unsigned char *)vertices;
+    vector<unsigned char> carried(vertexSize), displaced(vertexSize);
+    for(size_t i = 0; i < vertexCount; i++) {
+        if(remap[i] == i)
+            continue;
+        memcpy(carried.data(), v + i * vertexSize, vertexSize);
+        size_t to = remap[i];
+        remap[i] = i;
+        while(to != i) {
+            memcpy(displaced.data(), v + to * vertexSize, vertexSize);
+            memcpy(v + to * vertexSize, carried.data(), vertexSize);
+            swap(carried, displaced);
+            size_t next = remap[to];
+            remap[to] = to;
+            to = next;
+        }
+        memcpy(v + i * vertexSize, carried.data(), vertexSize);
+    }
+    return used;
+}
+
+// The index optimizations of OptimizeMesh, with statistics
+static void OptimizeIndices(unsigned int *indices, size_t indexCount, const float *positions, size_t stride, size_t vertexCount, VertexCacheStatistics& before)
+{
+    if(gPrintMeshStatistics)
+        before = AnalyzeVertexCache(indices, indexCount, vertexCount);
+
+    OptimizeVertexCache(indices, indexCount, vertexCount);
+    OptimizeOverdraw(indices, indexCount, positions, stride, vertexCount);
+}
+
+static void PrintStatistics(const VertexCacheStatistics& before, const unsigned int *indices, size_t indexCount, size_t used)
+{
+    if(gPrintMeshStatistics) {
+        VertexCacheStatistics after = AnalyzeVertexCache(indices, indexCount, used);
+        printf("%zu triangles, %zu vertices: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+            indexCount / 3, used, before.acmr, after.acmr, before.atvr, after.atvr);
+    }
+}
+
+size_t OptimizeMesh(void *vertices, size_t vertexSize, size_t positionOffset, size_t vertexCount, unsigned int *indices, size_t indexCount)
+{
+    VertexCacheStatistics before;
+    const float *positions = (const float *)((unsigned char *)vertices + positionOffset);
+    OptimizeIndices(indices, indexCount, positions, vertexSize, vertexCount, before);
+    size_t used = OptimizeVertexFetch(vertices, vertexSize, vertexCount, indices, indexCount);
+    PrintStatistics(before, indices, indexCount, used);
+    return used;
+}
+
+size_t OptimizeMeshOrder(unsigned int *indices, size_t indexCount, const float *positions, size_t stride, size_t vertexCount, vector<unsigned int>& remap)
+{
+    VertexCacheStatistics before;
+    OptimizeIndices(indices, indexCount, positions, stride, vertexCount, before);
+    size_t used = RemapVertexFetch(indices, indexCount, vertexCount, remap);
+    PrintStatistics(before, indices, indexCount, used);
+    return used;
+}
+
+namespace {
+
+struct MeshSplitter
+{
+    const unsigned char *vertices;
+    size_t vertexSize;
+    size_t positionOffset;
+    const unsigned int *indices;
+    size_t maxVertices;
+
+    vector<unsigned int> mark; // == pass if used by the part being counted
+    unsigned int pass;
+    vector<unsigned int> remap;
+    vector<MeshChunk> chunks;
+
+    const float *Position(unsigned int v) const
+    {
+        return (const float *)(vertices + vertexSize * v + positionOffset);
+    }
+
+    float Centroid(size_t triangle, int axis) const
+    {
+        const unsigned int *tri = &indices[triangle * 3];
+        return Position(tri[0])[axis] + Position(tri[1])[axis] + Position(tri[2])[axis];
+    }
+
+    size_t CountVertices(const size_t *first, const size_t *last)
+    {
+        pass++;
+        size_t count = 0;
+        for(const size_t *t = first; t != last; t++)
+            for(int j = 0; j < 3; j++) {
+                unsigned int v = indices[*t * 3 + j];
+                if(mark[v] != pass) {
+                    mark[v] = pass;
+                    count++;
+                }
+            }
+        return count;
+    }
+
+    void Emit(const size_t *first, const size_t *last)
+    {
+        chunks.push_back(MeshChunk());
+        MeshChunk& c = chunks.back();
+        c.vertexCount = 0;
+
+        pass++;
+        for(const size_t *t = first; t != last; t++)
+            for(int j = 0; j < 3; j++) {
+                unsigned int v = indices[*t * 3 + j];
+                if(mark[v] != pass) {
+                    mark[v] = pass;
+                    remap[v] = c.vertexCount++;
+                    c.vertices.insert(c.vertices.end(), vertices + vertexSize * v, vertices + vertexSize * (v + 1));
+                }
+                c.indices.push_back(remap[v]);
+            }
+    }
+
+    void Split(size_t *first, size_t *last)
+    {
+        if(last - first <= 1 || CountVertices(first, last) <= maxVertices) {
+            Emit(first, last);
+            return;
+        }
+
+        box bounds;
+        for(size_t *t = first; t != last; t++)
+            bounds.extend(vec3f(Centroid(*t, 0), Centroid(*t, 1), Centroid(*t, 2)));
+        vec3f extent = bounds.m_max - bounds.m_min;
+        int axis = (extent[0] >= extent[1] && extent[0] >= extent[2]) ? 0 : (extent[1] >= extent[2]) ? 1 : 2;
+
+        size_t *middle = first + (last - first) / 2;
+        nth_element(first, middle, last, [&](size_t a, size_t b) { return Centroid(a, axis) < Centroid(b, axis); });
+        Split(first, middle);
+        Split(middle, last);
+    }
+};
+
+};
+
+vector<MeshChunk> SplitMesh(const void *vertices, size_t vertexSize, size_t positionOffset, size_t vertexCount, const unsigned int *indices, size_t indexCount, size_t maxVertices)
+{
+    MeshSplitter s;
+    s.vertices = (const unsigned char *)vertices;
+    s.vertexSize = vertexSize;
+    s.positionOffset = positionOffset;
+    s.indices = indices;
+    s.maxVertices = maxVertices;
+    s.mark.resize(vertexCount, 0);
+    s.pass = 0;
+    s.remap.resize(vertexCount);
+
+    vector<size_t> triangles(indexCount / 3);
+    for(size_t t = 0; t < triangles.size(); t++)
+        triangles[t] = t;
+    if(!triangles.empty())
+        s.Split(&triangles[0], &triangles[0] + triangles.size());
+    return s.chunks;
+}
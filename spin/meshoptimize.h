@@ -0,0 +1,84 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#ifndef _MESHOPTIMIZE_H_
+#define _MESHOPTIMIZE_H_
+
+#include <cstddef>
+#include <vector>
+
+// Loaders print each shape's vertex cache statistics if set (spin's -v option)
+extern bool gPrintMeshStatistics;
+
+// Post-transform vertex cache use of an index order, simulating a FIFO
+// cache of cacheSize vertices
+struct VertexCacheStatistics
+{
+    float acmr; // vertices transformed per triangle, at best 0.5
+    float atvr; // vertices transformed per vertex referenced, at best 1
+};
+
+VertexCacheStatistics AnalyzeVertexCache(const unsigned int *indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = 16);
+
+// Reorder GL_TRIANGLES indices for the post-transform cache with
+// Forsyth's linear-speed greedy scoring
+void OptimizeVertexCache(unsigned int *indices, size_t indexCount, size_t vertexCount);
+
+// Split an index order made by OptimizeVertexCache into clusters where
+// the cache would mostly be refilled anyway, or where doing so costs at
+// most threshold times the cluster's ACMR, and draw clusters facing out
+// from the mesh's center first, after Sander et al.'s Tipsify.
+// positions are 3 floats at a byte stride.
+void OptimizeOverdraw(unsigned int *indices, size_t indexCount, const float *positions, size_t stride, size_t vertexCount, float threshold = 1.05f);
+
+// Marks a vertex no index refers to in the remaps below
+const unsigned int UNUSED_VERTEX = ~0u;
+
+// Number vertices in the order indices first use them and rewrite
+// indices to match.  remap[i] is vertex i's new index, or UNUSED_VERTEX.
+// Returns the count of vertices used.
+size_t RemapVertexFetch(unsigned int *indices, size_t indexCount, size_t vertexCount, std::vector<unsigned int>& remap);
+
+// Move vertices, each vertexSize bytes, into the order indices first use
+// them, in place, and rewrite indices to match.  Returns the count of
+// vertices left, dropping those no index refers to.
+size_t OptimizeVertexFetch(void *vertices, size_t vertexSize, size_t vertexCount, unsigned int *indices, size_t indexCount);
+
+// All three, in order, on a GL_TRIANGLES mesh whose positions are 3
+// floats at positionOffset in each vertex.  Returns the new vertex count.
+size_t OptimizeMesh(void *vertices, size_t vertexSize, size_t positionOffset, size_t vertexCount, unsigned int *indices, size_t indexCount);
+
+// The same for loaders that write vertices themselves, such as straight
+// into a mapped GeometryPool range: only indices change, and vertex i
+// belongs at remap[i] as from RemapVertexFetch.
+size_t OptimizeMeshOrder(unsigned int *indices, size_t indexCount, const float *positions, size_t stride, size_t vertexCount, std::vector<unsigned int>& remap);
+
+// Spatially coherent piece of a mesh, with its own copy of the vertices
+// it uses, in first-use order
+struct MeshChunk
+{
+    std::vector<unsigned char> vertices;
+    size_t vertexCount;
+    std::vector<unsigned int> indices;
+};
+
+// Split a GL_TRIANGLES mesh into chunks using at most maxVertices
+// vertices each, halving it across its longest axis until they fit, so
+// that chunks can use 16-bit indices and be culled separately
+std::vector<MeshChunk> SplitMesh(const void *vertices, size_t vertexSize, size_t positionOffset, size_t vertexCount, const unsigned int *indices, size_t indexCount, size_t maxVertices);
+
+#endif /* _MESHOPTIMIZE_H_ */
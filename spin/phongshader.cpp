@@ -15,7 +15,10 @@
 // 
 
 #include <string>
+#include <cstring>
+#include <algorithm>
 #include "phongshader.h"
+#include "glstate.h"
 
 using namespace std;
 
@@ -105,6 +108,13 @@ static GLuint GenerateProgram(const string& vertex_shader_text, const string& fr
     glAttachShader(program, fragment_shader);
     CheckOpenGL(__FILE__, __LINE__);
 
+    glBindAttribLocation(program, PhongShader::POSITION_LOCATION, "position");
+    glBindAttribLocation(program, PhongShader::NORMAL_LOCATION, "normal");
+    glBindAttribLocation(program, PhongShader::POSITION_LOCATION, "position_stored");
+    glBindAttribLocation(program, PhongShader::NORMAL_LOCATION, "normal_stored");
+    glBindAttribLocation(program, PhongShader::COLOR_LOCATION, "color");
+    glBindAttribLocation(program, PhongShader::TEXCOORD_LOCATION, "texcoord");
+
     glLinkProgram(program);
     CheckOpenGL(__FILE__, __LINE__);
     if(!CheckProgramLink(program))
@@ -113,28 +123,95 @@ static GLuint GenerateProgram(const string& vertex_shader_text, const string& fr
     return program;
 }
 
-void PhongShader::ProgramVariant::ApplyMaterial(PhongShader::MaterialPtr mtl)
+void PhongShader::ProgramVariant::ApplyMaterial(const PhongShader::MaterialPtr& mtl) const
 {
-    glUseProgram(program); // can switch to tex here
-    glUniform4fv(mtlu.ambient, 1, mtl->ambient);
-    glUniform4fv(mtlu.diffuse, 1, mtl->diffuse);
-    glUniform4fv(mtlu.specular, 1, mtl->specular);
-    glUniform1f(mtlu.shininess, mtl->shininess);
+    // Mostly elided by the cache when consecutive draws share a material
+    gGLState.UseProgram(program);
+    PhongShader::gShader->BindMaterial(*mtl);
     if(mtlu.diffuseTexture != -1)
     {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, mtl->diffuseTexture);
-        glUniform1i(mtlu.diffuseTexture, 0);
+        gGLState.BindTexture(0, GL_TEXTURE_2D, mtl->diffuseTexture);
+        gGLState.Uniform1i(mtlu.diffuseTexture, 0);
+    }
+    CheckOpenGL(__FILE__, __LINE__);
+}
+
+void PhongShader::ProgramVariant::ApplyShape(const DrawList& dl) const
+{
+    if(shapeu.positionScale != -1) {
+        gGLState.Uniform4fv(shapeu.positionScale, dl.positionScale.m_v);
+        gGLState.Uniform4fv(shapeu.positionOffset, dl.positionOffset.m_v);
+    }
+    // Not cached; drawing with the array enabled may change the value
+    if(!dl.hasColors)
+        glVertexAttrib4fv(PhongShader::COLOR_LOCATION, dl.color.m_v);
+}
+
+void PhongShader::UpdateMaterial(const Material& mtl)
+{
+    if(mtl.id >= materialStored.size()) {
+        size_t capacity = std::max((size_t)64, (size_t)mtl.id * 2);
+        materialData.resize(capacity * materialStride);
+        materialStored.resize(capacity, false);
+
+        if(materialBuffer == 0)
+            glGenBuffers(1, &materialBuffer);
+        gGLState.BindBuffer(GL_UNIFORM_BUFFER, materialBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, materialData.size(), materialData.data(), GL_STATIC_DRAW);
     }
+
+    MaterialBlock b;
+    b.diffuse = mtl.diffuse;
+    b.specular = mtl.specular;
+    b.ambient = mtl.ambient;
+    b.shininess = mtl.shininess;
+    b.pad[0] = b.pad[1] = b.pad[2] = 0;
+
+    size_t offset = mtl.id * materialStride;
+    memcpy(&materialData[offset], &b, sizeof(b));
+    materialStored[mtl.id] = true;
+
+    gGLState.BindBuffer(GL_UNIFORM_BUFFER, materialBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(b), &b);
     CheckOpenGL(__FILE__, __LINE__);
 }
 
-const char *PhongShader::vertexShaderText = "\n\
-    uniform mat4 modelview_matrix;\n\
-    uniform mat4 modelview_normal_matrix;\n\
-    uniform mat4 projection_matrix;\n\
+void PhongShader::BindMaterial(const Material& mtl)
+{
+    if(mtl.id >= materialStored.size() || !materialStored[mtl.id])
+        UpdateMaterial(mtl);
+    gGLState.BindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_UNIFORM_BINDING, materialBuffer, mtl.id * materialStride, sizeof(MaterialBlock));
+}
+
+// Both stages declare the blocks they share identically
+#define ENVIRONMENT_BLOCK_TEXT "\n\
+    layout(std140) uniform Environment {\n\
+        mat4 projection_matrix;\n\
+        vec4 light_position;\n\
+        vec4 light_color;\n\
+    };\n"
+
+const char *PhongShader::vertexShaderText = ENVIRONMENT_BLOCK_TEXT "\n\
+    #if defined(INSTANCED)\n\
+    // modelview, normal matrix per instance, 4 columns each\n\
+    uniform samplerBuffer instance_matrices;\n\
+    uniform int instance_base;\n\
+    #else\n\
+    layout(std140) uniform Object {\n\
+        mat4 modelview_matrix;\n\
+        mat4 modelview_normal_matrix;\n\
+    };\n\
+    #endif\n\
+    #if defined(COMPACT)\n\
+    // See compactvertex.h; position = stored * scale + offset\n\
+    uniform vec4 position_scale;\n\
+    uniform vec4 position_offset;\n\
+    in vec3 position_stored;\n\
+    in vec2 normal_stored;\n\
+    #else\n\
     in vec3 position;\n\
     in vec3 normal;\n\
+    #endif\n\
     in vec4 color;\n\
     #if defined(TEXTURING)\n\
     in vec2 texcoord;\n\
@@ -148,8 +225,29 @@ const char *PhongShader::vertexShaderText = "\n\
     out vec2 vertex_texcoord;\n\
     #endif\n\
     \n\
+    #if defined(COMPACT)\n\
+    // Unfold an octahedral normal, as oct_decode does\n\
+    vec3 oct_decode(vec2 e)\n\
+    {\n\
+        vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n\
+        if(n.z < 0.0)\n\
+            n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);\n\
+        return normalize(n);\n\
+    }\n\
+    #endif\n\
+    \n\
     void main()\n\
     {\n\
+        #if defined(COMPACT)\n\
+        vec3 position = position_stored * position_scale.xyz + position_offset.xyz;\n\
+        vec3 normal = oct_decode(normal_stored);\n\
+        #endif\n\
+    \n\
+        #if defined(INSTANCED)\n\
+        int t = (instance_base + gl_InstanceID) * 8;\n\
+        mat4 modelview_matrix = mat4(texelFetch(instance_matrices, t), texelFetch(instance_matrices, t + 1), texelFetch(instance_matrices, t + 2), texelFetch(instance_matrices, t + 3));\n\
+        mat4 modelview_normal_matrix = mat4(texelFetch(instance_matrices, t + 4), texelFetch(instance_matrices, t + 5), texelFetch(instance_matrices, t + 6), texelFetch(instance_matrices, t + 7));\n\
+        #endif\n\
     \n\
         vertex_normal = (modelview_normal_matrix * vec4(normal, 0.0)).xyz;\n\
         vertex_position = modelview_matrix * vec4(position, 1.0);\n\
@@ -163,14 +261,13 @@ const char *PhongShader::vertexShaderText = "\n\
         ;\n\
     }\n";
 
-const char *PhongShader::fragmentShaderText = "\n\
-    uniform vec4 material_diffuse;\n\
-    uniform vec4 material_specular;\n\
-    uniform vec4 material_ambient;\n\
-    uniform float material_shininess;\n\
-    \n\
-    uniform vec4 light_position;\n\
-    uniform vec4 light_color;\n\
+const char *PhongShader::fragmentShaderText = ENVIRONMENT_BLOCK_TEXT "\n\
+    layout(std140) uniform Material {\n\
+        vec4 material_diffuse;\n\
+        vec4 material_specular;\n\
+        vec4 material_ambient;\n\
+        float material_shininess;\n\
+    };\n\
     \n\
     #if defined(TEXTURING)\n\
     uniform sampler2D material_diffuse_texture;\n\
@@ -220,40 +317,58 @@ const char *PhongShader::fragmentShaderText = "\n\
         color = diffuse * material_diffuse * vertex_color + ambient * material_ambient * vertex_color + specular * material_specular;\n\
     }\n";
 
-void SetupVariant(bool texturing, PhongShader::ProgramVariant& v)
+static void BindUniformBlock(GLuint program, const char *name, GLuint binding)
+{
+    GLuint block = glGetUniformBlockIndex(program, name);
+    if(block != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, block, binding);
+}
+
+void SetupVariant(bool texturing, bool instanced, bool compact, PhongShader::ProgramVariant& v)
 {
     string preamble = texturing ? "#define TEXTURING\n" : "#undef TEXTURING\n";
+    preamble += instanced ? "#define INSTANCED\n" : "#undef INSTANCED\n";
+    preamble += compact ? "#define COMPACT\n" : "#undef COMPACT\n";
     v.program = GenerateProgram(preamble + PhongShader::vertexShaderText, preamble + PhongShader::fragmentShaderText);
     CheckOpenGL(__FILE__, __LINE__);
 
-    glUseProgram(v.program);
+    gGLState.UseProgram(v.program);
 
-    v.positionAttrib = glGetAttribLocation(v.program, "position");
-    v.normalAttrib = glGetAttribLocation(v.program, "normal");
+    v.positionAttrib = glGetAttribLocation(v.program, compact ? "position_stored" : "position");
+    v.normalAttrib = glGetAttribLocation(v.program, compact ? "normal_stored" : "normal");
     v.colorAttrib = glGetAttribLocation(v.program, "color");
     if(texturing) 
         v.texcoordAttrib = glGetAttribLocation(v.program, "texcoord");
     CheckOpenGL(__FILE__, __LINE__);
 
-    v.mtlu.diffuse = glGetUniformLocation(v.program, "material_diffuse");
     v.mtlu.diffuseTexture = texturing ? glGetUniformLocation(v.program, "material_diffuse_texture") : -1;
-    v.mtlu.specular = glGetUniformLocation(v.program, "material_specular");
-    v.mtlu.ambient = glGetUniformLocation(v.program, "material_ambient");
-    v.mtlu.shininess = glGetUniformLocation(v.program, "material_shininess");
+    v.shapeu.positionScale = compact ? glGetUniformLocation(v.program, "position_scale") : -1;
+    v.shapeu.positionOffset = compact ? glGetUniformLocation(v.program, "position_offset") : -1;
 
-    v.envu.lightPosition = glGetUniformLocation(v.program, "light_position");
-    v.envu.lightColor = glGetUniformLocation(v.program, "light_color");
+    BindUniformBlock(v.program, "Environment", ENVIRONMENT_UNIFORM_BINDING);
+    BindUniformBlock(v.program, "Object", OBJECT_UNIFORM_BINDING);
+    BindUniformBlock(v.program, "Material", MATERIAL_UNIFORM_BINDING);
 
-    v.envu.modelview = glGetUniformLocation(v.program, "modelview_matrix");
-    v.envu.modelviewNormal = glGetUniformLocation(v.program, "modelview_normal_matrix");
-    v.envu.projection = glGetUniformLocation(v.program, "projection_matrix");
+    v.envu.instanceMatrices = glGetUniformLocation(v.program, "instance_matrices");
+    v.envu.instanceBase = glGetUniformLocation(v.program, "instance_base");
+    if(instanced)
+        gGLState.Uniform1i(v.envu.instanceMatrices, INSTANCE_MATRIX_TEXTURE_UNIT);
     CheckOpenGL(__FILE__, __LINE__);
 }
 
 void PhongShader::Setup()
 {
-    SetupVariant(false, nontextured);
-    SetupVariant(true, textured);
+    GLint alignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    materialStride = (sizeof(MaterialBlock) + alignment - 1) / alignment * alignment;
+
+    for(int i = 0; i < VARIANT_COUNT; i++)
+        SetupVariant(i & TEXTURED, i & INSTANCED, i & COMPACT, variants[i]);
+}
+
+const PhongShader::ProgramVariant& PhongShader::GetVariant(bool texturing, bool instanced, bool compact)
+{
+    return variants[(texturing ? TEXTURED : 0) | (instanced ? INSTANCED : 0) | (compact ? COMPACT : 0)];
 }
 
 PhongShaderPtr PhongShader::gShader;
@@ -270,29 +385,62 @@ PhongShaderPtr PhongShader::GetForCurrentContext()
 
 GLuint PhongShadedGeometry::GetProgram()
 {
-    if(material->diffuseTexture != GL_NONE)
-        return PhongShader::GetForCurrentContext()->textured.program;
-    else
-        return PhongShader::GetForCurrentContext()->nontextured.program;
+    return PhongShader::GetForCurrentContext()->GetVariant(material->diffuseTexture != GL_NONE, false, drawList->compact).program;
 }
 
 EnvironmentUniforms PhongShadedGeometry::GetEnvironmentUniforms()
 {
-    if(material->diffuseTexture != GL_NONE)
-        return PhongShader::GetForCurrentContext()->textured.envu;
-    else
-        return PhongShader::GetForCurrentContext()->nontextured.envu;
+    return PhongShader::GetForCurrentContext()->GetVariant(material->diffuseTexture != GL_NONE, false, drawList->compact).envu;
+}
+
+GLuint PhongShadedGeometry::GetInstancedProgram()
+{
+    return PhongShader::GetForCurrentContext()->GetVariant(material->diffuseTexture != GL_NONE, true, drawList->compact).program;
+}
+
+EnvironmentUniforms PhongShadedGeometry::GetInstancedEnvironmentUniforms()
+{
+    return PhongShader::GetForCurrentContext()->GetVariant(material->diffuseTexture != GL_NONE, true, drawList->compact).envu;
 }
 
 void PhongShadedGeometry::Draw(float objectTime, bool drawWireframe)
 {
     CheckOpenGL(__FILE__, __LINE__);
 
-    if(material->diffuseTexture != GL_NONE)
-        PhongShader::GetForCurrentContext()->textured.ApplyMaterial(material);
-    else
-        PhongShader::GetForCurrentContext()->nontextured.ApplyMaterial(material);
+    const PhongShader::ProgramVariant& v = PhongShader::GetForCurrentContext()->GetVariant(material->diffuseTexture != GL_NONE, false, drawList->compact);
+    v.ApplyMaterial(material);
+    v.ApplyShape(*drawList);
     CheckOpenGL(__FILE__, __LINE__);
 
     drawList->Draw(drawWireframe);
 }
+
+void PhongShadedGeometry::DrawInstanced(float objectTime, GLsizei instances)
+{
+    CheckOpenGL(__FILE__, __LINE__);
+
+    const PhongShader::ProgramVariant& v = PhongShader::GetForCurrentContext()->GetVariant(material->diffuseTexture != GL_NONE, true, drawList->compact);
+    v.ApplyMaterial(material);
+    v.ApplyShape(*drawList);
+    CheckOpenGL(__FILE__, __LINE__);
+
+    drawList->DrawInstanced(instances);
+}
+
+bool PhongShadedGeometry::SharesStateWith(const Drawable& other)
+{
+    const PhongShadedGeometry *g = dynamic_cast<const PhongShadedGeometry*>(&other);
+    return g != NULL && g->material == material && g->drawList->DecodesLike(*drawList);
+}
+
+void PhongShadedGeometry::DrawRanges(float objectTime, const MultiDraw& ranges)
+{
+    CheckOpenGL(__FILE__, __LINE__);
+
+    const PhongShader::ProgramVariant& v = PhongShader::GetForCurrentContext()->GetVariant(material->diffuseTexture != GL_NONE, false, drawList->compact);
+    v.ApplyMaterial(material);
+    v.ApplyShape(*drawList);
+    CheckOpenGL(__FILE__, __LINE__);
+
+    ranges.Submit();
+}
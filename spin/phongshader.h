@@ -17,6 +17,7 @@
 #ifndef _PHONGSHADER_H_
 #define _PHONGSHADER_H_
 
+#include <vector>
 #include "drawable.h"
 
 struct PhongShader;
@@ -32,6 +33,7 @@ struct PhongShader
         vec4f ambient;
         vec4f specular;
         float shininess;
+        unsigned int id; // unique per Material, for sorting draws
 
         Material(const vec4f& diffuse_, const vec4f& ambient_,
             const vec4f& specular_, float shininess_) :
@@ -39,7 +41,8 @@ struct PhongShader
             diffuseTexture(GL_NONE),
             ambient(ambient_),
             specular(specular_),
-            shininess(shininess_)
+            shininess(shininess_),
+            id(NextId())
         { }
 
         Material(const vec4f& diffuse_, GLuint diffuseTexture_, const vec4f& ambient_,
@@ -48,7 +51,8 @@ struct PhongShader
             diffuseTexture(diffuseTexture_),
             ambient(ambient_),
             specular(specular_),
-            shininess(shininess_)
+            shininess(shininess_),
+            id(NextId())
         { }
 
         Material() :
@@ -56,37 +60,92 @@ struct PhongShader
             diffuseTexture(GL_NONE),
             ambient(vec4f(.2, .2, .2, 1)),
             specular(vec4f(.8, .8, .8, 1)),
-            shininess(0)
+            shininess(0),
+            id(NextId())
         { }
+
+        static unsigned int NextId() { static unsigned int next = 0; return next++; }
     };
     typedef std::shared_ptr<Material> MaterialPtr;
 
+    // Mirrors the std140 "Material" block
+    struct MaterialBlock
+    {
+        vec4f diffuse;
+        vec4f specular;
+        vec4f ambient;
+        float shininess;
+        float pad[3];
+    };
+
+    // Material uniforms not in the block
     struct MaterialUniforms
     {
-        GLint diffuse;
-        GLint ambient;
-        GLint specular;
-        GLint shininess;
         GLint diffuseTexture; // unused in nontextured 
     };
 
+    // Decoding of compact vertices (see compactvertex.h); -1 otherwise
+    struct ShapeUniforms
+    {
+        GLint positionScale;
+        GLint positionOffset;
+    };
+
     struct ProgramVariant {
         GLuint program;
         MaterialUniforms mtlu;
         EnvironmentUniforms envu;
+        ShapeUniforms shapeu;
 
         int positionAttrib;
         int normalAttrib; 
         int colorAttrib; 
         int texcoordAttrib;  // unused in nontextured
 
-        void ApplyMaterial(MaterialPtr mtl);
-    } nontextured, textured;
+        void ApplyMaterial(const MaterialPtr& mtl) const;
+        void ApplyShape(const DrawList& dl) const;
+    };
+
+    // Variants are indexed by these flags; INSTANCED variants take
+    // modelview matrices per instance from the instance buffer and
+    // COMPACT variants decode quantized vertex attributes
+    enum {
+        TEXTURED = 1,
+        INSTANCED = 2,
+        COMPACT = 4,
+        VARIANT_COUNT = 8,
+    };
+    ProgramVariant variants[VARIANT_COUNT];
+
+    const ProgramVariant& GetVariant(bool texturing, bool instanced, bool compact);
+
+    // Every Material drawn so far has a MaterialBlock in materialBuffer
+    // at materialStride * id, stored on first use; draws just bind
+    // the range.  Call UpdateMaterial after changing a Material.
+    GLuint materialBuffer;
+    size_t materialStride;
+    std::vector<unsigned char> materialData; // copy of materialBuffer
+    std::vector<bool> materialStored;
+
+    void BindMaterial(const Material& mtl);
+    void UpdateMaterial(const Material& mtl);
+
+    // Bound before linking so all variants can share vertex arrays
+    enum {
+        POSITION_LOCATION = 0,
+        NORMAL_LOCATION = 1,
+        COLOR_LOCATION = 2,
+        TEXCOORD_LOCATION = 3,
+    };
 
     static const char *vertexShaderText;
     static const char *fragmentShaderText;
 
     virtual void Setup();
+    PhongShader() :
+        materialBuffer(0),
+        materialStride(sizeof(MaterialBlock))
+    {}
     virtual ~PhongShader() {}
 
     static PhongShaderPtr GetForCurrentContext();
@@ -105,6 +164,12 @@ struct PhongShadedGeometry : public Drawable
     virtual void Draw(float objectTime, bool drawWireframe);
     virtual GLuint GetProgram();
     virtual EnvironmentUniforms GetEnvironmentUniforms();
+    virtual unsigned int GetMaterialKey() { return material->id; }
+    virtual GLuint GetInstancedProgram();
+    virtual EnvironmentUniforms GetInstancedEnvironmentUniforms();
+    virtual void DrawInstanced(float objectTime, GLsizei instances);
+    virtual bool SharesStateWith(const Drawable& other);
+    virtual void DrawRanges(float objectTime, const MultiDraw& ranges);
     virtual ~PhongShadedGeometry() {}
 };
 typedef std::shared_ptr<PhongShadedGeometry> PhongShadedGeometryPtr;
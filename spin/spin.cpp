@@ -16,6 +16,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <map>
 #include <limits>
@@ -23,6 +24,8 @@
 #include <vector>
 #include <unistd.h>
 #include <chrono>
+#include <atomic>
+#include <new>
 
 #define GLFW_INCLUDE_GLCOREARB
 #include <GLFW/glfw3.h>
@@ -32,6 +35,13 @@
 #include "manipulator.h"
 
 #include "drawable.h"
+#include "flatscene.h"
+#include "glstate.h"
+#include "uniformring.h"
+#include "compactvertex.h"
+#include "meshoptimize.h"
+#include "vertexweld.h"
+#include "meshcache.h"
 #include "loader.h"
 
 using namespace std;
@@ -39,6 +49,8 @@ using namespace std;
 //------------------------------------------------------------------------
 
 static bool gDrawWireframe = false;
+static bool gCullToFrustum = true;
+static bool gInstancing = true;
 static bool gStreamFrames = false;
 
 static int gWindowWidth;
@@ -47,25 +59,40 @@ static int gWindowHeight;
 static double gMotionReported = false;
 static double gOldMouseX, gOldMouseY;
 
-// XXX Allow these to be set by options
-bool gVerbose = false;
+bool gVerbose = false; // -v
 
 // XXX Controller needs ability to set camera projection...
 const float gFOV = 45; // XXX XXX also gFOV in DefaultController...
 
 NodePtr gSceneRoot;
+FlatScene gFlatScene;
 ControllerPtr gSceneController;
 
-bool ExactlyEqual(const mat4f&m1, const mat4f&m2)
+// Count heap allocations so we can check that steady-state frames make none
+static atomic<size_t> gHeapAllocations(0);
+
+void *operator new(size_t size)
+{
+    gHeapAllocations.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(size ? size : 1);
+    if(p == NULL)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
 {
-    for(int i = 0; i < 16; i++)
-        if(m1[i] != m2[i])
-            return false;
-    return true;
+    free(p);
 }
 
 void DrawScene(float now)
 {
+    size_t allocationsBefore = gHeapAllocations.load(memory_order_relaxed);
+
+    // Loaders and the rest of spin bind textures and buffers directly
+    gGLState.Invalidate();
+    gGLState.ResetCounters();
+
     float nearClip, farClip;
 
     /* XXX - need to create new box from all subordinate boxes */
@@ -82,60 +109,165 @@ void DrawScene(float now)
     frustumLeft = -frustumRight;
     mat4f tmp_projection = mat4f::frustum(frustumLeft, frustumRight, frustumBottom, frustumTop, nearClip, farClip);
 
-    Light light(vec4f(.577, .577, .577, 0), vec4f(1, 1, 1, 1));
-
-    vector<Light> lights;
-    lights.push_back(light);
-    Environment env(tmp_projection, mat4f::identity, lights);
-    DisplayList displaylist;
-    gSceneRoot->Visit(env, displaylist);
-
-    mat4f projection;
-    mat4f modelview;
-    bool loadMatrices = true;
+    static const vector<Light> lights(1, Light(vec4f(.577, .577, .577, 0), vec4f(1, 1, 1, 1)));
+    vec4f frustum[6];
+    make_clip_planes(tmp_projection, frustum);
+
+    Environment env(tmp_projection, mat4f::identity, lights, gCullToFrustum ? frustum : NULL);
+    // Reuse last frame's sorted list unless the scene, projection or
+    // culling mode changed, e.g. on a refresh with nothing moving.  Any
+    // transform change, the root's during a drag included, changes the
+    // scene's version: culling and depth order depend on the root, so
+    // dragging still runs Visit and Sort every frame.
+    static DisplayList displaylist;
+    static unsigned int listSceneVersion = ~0u;
+    static mat4f listProjection;
+    static bool listCulled;
+    static bool listInstanced;
+    static vector<ObjectBlock> objects; // per displaylist.matrices entry
+
+    static UniformRing uniformRing;
+
+    // Instance matrices, read by instanced programs through a buffer texture
+    static GLuint instanceBuffer = 0;
+    static GLuint instanceTexture = 0;
+    static GLint maxInstanceTexels = 0;
+    if(instanceBuffer == 0) {
+        glGenBuffers(1, &instanceBuffer);
+        glGenTextures(1, &instanceTexture);
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxInstanceTexels);
+
+        // The texture follows the buffer's storage as it's respecified.
+        // Never bound before, so this bind is issued and the unit active.
+        gGLState.BindTexture(INSTANCE_MATRIX_TEXTURE_UNIT, GL_TEXTURE_BUFFER, instanceTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instanceBuffer);
+        CheckOpenGL(__FILE__, __LINE__);
+    }
 
-    GLuint program = 0;
+    gFlatScene.Update();
 
-    for(auto it : displaylist) {
-        DisplayInfo displayinfo = it.first;
-        vector<DrawablePtr>& drawables = it.second;
-        EnvironmentUniforms& envu = displayinfo.envu;
+    bool reused = listSceneVersion == gFlatScene.version &&
+        memcmp(listProjection.m_v, tmp_projection.m_v, sizeof(tmp_projection.m_v)) == 0 &&
+        listCulled == gCullToFrustum &&
+        listInstanced == gInstancing;
 
-        if(program != displayinfo.program) {
-            glUseProgram(displayinfo.program);
-            loadMatrices = true;
+    if(!reused) {
+        displaylist.Clear();
+        displaylist.instancing = gInstancing;
+        gFlatScene.Visit(env, displaylist);
+        displaylist.Sort();
 
-            // XXX Should be loaded from environment
-            glUniform4fv(envu.lightPosition, 1, lights[0].position.m_v);
-            glUniform4fv(envu.lightColor, 1, lights[0].color.m_v);
+        if(!displaylist.instanceMatrices.empty()) {
+            gGLState.BindBuffer(GL_TEXTURE_BUFFER, instanceBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, displaylist.instanceMatrices.size() * sizeof(mat4f), displaylist.instanceMatrices.data(), GL_STATIC_DRAW);
+            gGLState.BindBuffer(GL_TEXTURE_BUFFER, 0);
             CheckOpenGL(__FILE__, __LINE__);
+        }
 
-            program = displayinfo.program;
+        // Object blocks for every modelview, copied to the ring each frame
+        objects.resize(displaylist.matrices.size());
+        for(size_t i = 0; i < objects.size(); i++) {
+            objects[i].modelview = displaylist.matrices[i];
+            objects[i].modelviewNormal = displaylist.matrices[i].normal_matrix();
         }
 
-        if(loadMatrices || !ExactlyEqual(modelview, displayinfo.modelview)) {
-            mat4f modelview_normal = displayinfo.modelview;
-            // XXX might not invert every time
-            // XXX parallel normal matrix math path?
-            modelview_normal.transpose();
-            modelview_normal.invert();
+        listSceneVersion = gFlatScene.version;
+        listProjection = tmp_projection;
+        listCulled = gCullToFrustum;
+        listInstanced = gInstancing;
+    }
 
-            glUniformMatrix4fv(envu.modelview, 1, GL_FALSE, displayinfo.modelview.m_v);
-            glUniformMatrix4fv(envu.modelviewNormal, 1, GL_FALSE, modelview_normal.m_v);
-            modelview = displayinfo.modelview;
-        }
+    // Each mat4f is four RGBA32F texels; draw singly if they don't fit
+    bool canInstance = !gDrawWireframe &&
+        displaylist.instanceMatrices.size() * 4 <= (size_t)maxInstanceTexels;
+    if(canInstance && !displaylist.instanceMatrices.empty()) {
+        gGLState.BindTexture(INSTANCE_MATRIX_TEXTURE_UNIT, GL_TEXTURE_BUFFER, instanceTexture);
+        CheckOpenGL(__FILE__, __LINE__);
+    }
 
-        if(loadMatrices || !ExactlyEqual(projection, displayinfo.projection)) {
-            glUniformMatrix4fv(envu.projection, 1, GL_FALSE, displayinfo.projection.m_v);
-            projection = displayinfo.projection;
-        }
+    // This frame's Environment block, then an Object block per matrix
+    EnvironmentBlock environment;
+    environment.projection = tmp_projection;
+    environment.lightPosition = lights[0].position; // only one supported
+    environment.lightColor = lights[0].color;
+
+    size_t environmentSize = uniformRing.Align(sizeof(EnvironmentBlock));
+    size_t objectStride = uniformRing.Align(sizeof(ObjectBlock));
+    unsigned char *uniforms = uniformRing.Map(environmentSize + objectStride * objects.size());
+    memcpy(uniforms, &environment, sizeof(environment));
+    for(size_t i = 0; i < objects.size(); i++)
+        memcpy(uniforms + environmentSize + objectStride * i, &objects[i], sizeof(ObjectBlock));
+    uniformRing.Unmap();
 
-        loadMatrices = false;
+    gGLState.BindBufferRange(GL_UNIFORM_BUFFER, ENVIRONMENT_UNIFORM_BINDING, uniformRing.buffer, uniformRing.segmentOffset, sizeof(EnvironmentBlock));
+    size_t objectsOffset = uniformRing.segmentOffset + environmentSize;
 
-        for(auto drawable : drawables) {
-            drawable->Draw(now, gDrawWireframe);
+    GLuint program = 0;
+    unsigned int modelview = ~0u;
+    size_t drawCalls = 0;
+    static MultiDraw merged;
+
+    for(size_t bi = 0; bi < displaylist.batches.size(); bi++) {
+        const DisplayList::Batch& b = displaylist.batches[bi];
+        bool instanced = b.count > 1 && canInstance;
+
+        for(unsigned int i = b.first; i < b.first + b.count; i++) {
+            const DisplayList::Packet& p = displaylist.packets[displaylist.order[i].packet];
+            GLuint wanted = instanced ? p.drawable->GetInstancedProgram() : p.program;
+            EnvironmentUniforms envu = instanced ? p.drawable->GetInstancedEnvironmentUniforms() : p.envu;
+
+            if(program != wanted) {
+                gGLState.UseProgram(wanted);
+                program = wanted;
+            }
+
+            if(instanced) {
+                gGLState.Uniform1i(envu.instanceBase, b.instanceBase);
+                p.drawable->DrawInstanced(now, b.count);
+                drawCalls++;
+                break;
+            }
+
+            if(modelview != p.modelview) {
+                gGLState.BindBufferRange(GL_UNIFORM_BUFFER, OBJECT_UNIFORM_BINDING, uniformRing.buffer, objectsOffset + objectStride * p.modelview, sizeof(ObjectBlock));
+                modelview = p.modelview;
+            }
+
+            // Submit following draws with the same state, matrices and
+            // vertex array together with this one
+            merged.Clear();
+            if(b.count == 1 && !gDrawWireframe && p.drawable->drawList)
+                merged.Append(*p.drawable->drawList);
+            size_t mergedCount = 1;
+            while(!merged.empty() && bi + 1 < displaylist.batches.size()) {
+                const DisplayList::Batch& next = displaylist.batches[bi + 1];
+                if(next.count != 1)
+                    break;
+                const DisplayList::Packet& q = displaylist.packets[displaylist.order[next.first].packet];
+                if(q.program != p.program || q.modelview != p.modelview || q.projection != p.projection ||
+                    !q.drawable->drawList || q.drawable->drawList->vertexArray != merged.vertexArray ||
+                    !p.drawable->SharesStateWith(*q.drawable) || !merged.Append(*q.drawable->drawList))
+                    break;
+                mergedCount++;
+                bi++;
+            }
+
+            if(mergedCount > 1)
+                p.drawable->DrawRanges(now, merged);
+            else
+                p.drawable->Draw(now, gDrawWireframe);
+            drawCalls++;
         }
     }
+
+    uniformRing.Fence();
+
+    if(gVerbose) {
+        size_t allocations = gHeapAllocations.load(memory_order_relaxed) - allocationsBefore;
+        printf("DrawScene: %zu shapes in %zu draws%s, %zu heap allocations, %zu arena blocks total\n",
+            displaylist.packets.size(), drawCalls, reused ? " (reused)" : "", allocations, displaylist.arena.blockAllocations);
+        printf("DrawScene: %zu state calls issued, %zu elided\n", gGLState.issued, gGLState.elided);
+    }
 }
 
 void InitializeGL()
@@ -171,6 +303,14 @@ static void KeyCallback(GLFWwindow *window, int key, int scancode, int action, i
                 gDrawWireframe = !gDrawWireframe;
                 break;
 
+            case 'C':
+                gCullToFrustum = !gCullToFrustum;
+                break;
+
+            case 'I':
+                gInstancing = !gInstancing;
+                break;
+
             default:
                 bool quit = gSceneController->Key(key, scancode, action, mods);
                 if(quit)
@@ -257,12 +397,37 @@ static void DrawFrame(GLFWwindow *window)
 int main(int argc, char **argv)
 {
     const char *progname = argv[0];
-    if(argc < 2) {
-        fprintf(stderr, "usage: %s filename # e.g. \"%s 64gon.builtin\"\n", progname, progname);
+    argc--;
+    argv++;
+    while(argc > 0 && argv[0][0] == '-') {
+        if(strcmp(argv[0], "-q") == 0) {
+            gCompactVertices = true;
+        } else if(strcmp(argv[0], "-v") == 0) {
+            gVerbose = true;
+            gPrintMeshStatistics = true;
+        } else if(strcmp(argv[0], "-w") == 0 && argc > 1) {
+            gWeldEpsilon = atof(argv[1]);
+            argc--;
+            argv++;
+        } else if(strcmp(argv[0], "-n") == 0) {
+            gUseMeshCache = false;
+        } else {
+            fprintf(stderr, "unknown option \"%s\"\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        argc--;
+        argv++;
+    }
+    if(argc < 1) {
+        fprintf(stderr, "usage: %s [-n] [-q] [-v] [-w epsilon] filename # e.g. \"%s 64gon.builtin\"\n", progname, progname);
+        fprintf(stderr, "\t-n  don't use or fill the mesh cache\n");
+        fprintf(stderr, "\t-q  store vertices quantized\n");
+        fprintf(stderr, "\t-v  print statistics while loading and drawing\n");
+        fprintf(stderr, "\t-w  weld vertices within epsilon, not only identical ones\n");
         exit(EXIT_FAILURE);
     }
 
-    const char *scene_filename = argv[1];
+    const char *scene_filename = argv[0];
 
     GLFWwindow* window;
 
@@ -294,6 +459,7 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
     InitializeScene(gSceneRoot);
+    gFlatScene.Build(gSceneRoot);
 
     if(gVerbose) {
         printf("GL_RENDERER: %s\n", glGetString(GL_RENDERER));
@@ -0,0 +1,158 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include "trib.h"
+
+using namespace std;
+
+bool TribWriter::AddMaterial(const string& texture, const float diffuse[4], const float ambient[4], const float specular[4], float shininess, unsigned int& index)
+{
+    TribMaterial m;
+    if(texture.size() >= sizeof(m.texture)) {
+        fprintf(stderr, "texture name \"%s\" is too long for .trib\n", texture.c_str());
+        return false;
+    }
+
+    memset(&m, 0, sizeof(m));
+    strcpy(m.texture, texture.c_str());
+    memcpy(m.diffuse, diffuse, sizeof(m.diffuse));
+    memcpy(m.ambient, ambient, sizeof(m.ambient));
+    memcpy(m.specular, specular, sizeof(m.specular));
+    m.shininess = shininess;
+    materials.push_back(m);
+    index = materials.size() - 1;
+    return true;
+}
+
+unsigned int TribWriter::AddShape(unsigned int material, const TribVertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount)
+{
+    return AddShape(material, vector<TribVertex>(vertices, vertices + vertexCount), indices, indexCount);
+}
+
+unsigned int TribWriter::AddShape(unsigned int material, vector<TribVertex>&& vertices, const unsigned int *indices, size_t indexCount)
+{
+    size_t vertexCount = vertices.size();
+
+    shapes.push_back(Shape());
+    Shape& s = shapes.back();
+
+    memset(&s.info, 0, sizeof(s.info));
+    s.info.material = material;
+    s.info.indexSize = (vertexCount <= 65536) ? 2 : 4;
+    s.info.vertexCount = vertexCount;
+    s.info.indexCount = indexCount;
+
+    for(int j = 0; j < 3; j++) {
+        s.info.boundsMin[j] = vertexCount ? vertices[0].v[j] : 0;
+        s.info.boundsMax[j] = vertexCount ? vertices[0].v[j] : 0;
+    }
+    for(size_t i = 0; i < vertexCount; i++)
+        for(int j = 0; j < 3; j++) {
+            s.info.boundsMin[j] = min(s.info.boundsMin[j], vertices[i].v[j]);
+            s.info.boundsMax[j] = max(s.info.boundsMax[j], vertices[i].v[j]);
+        }
+
+    s.vertices = move(vertices);
+    s.indices.resize(indexCount * s.info.indexSize);
+    if(s.info.indexSize == 2) {
+        uint16_t *shortIndices = (uint16_t *)s.indices.data();
+        for(size_t i = 0; i < indexCount; i++)
+            shortIndices[i] = indices[i];
+    } else {
+        memcpy(s.indices.data(), indices, indexCount * sizeof(uint32_t));
+    }
+
+    return shapes.size() - 1;
+}
+
+void TribWriter::AddGroup(const float transform[16], unsigned int childCount)
+{
+    TribNode n;
+    memset(&n, 0, sizeof(n));
+    memcpy(n.transform, transform, sizeof(n.transform));
+    n.shape = -1;
+    n.childCount = childCount;
+    nodes.push_back(n);
+}
+
+void TribWriter::AddShapeNode(unsigned int shape)
+{
+    TribNode n;
+    memset(&n, 0, sizeof(n));
+    n.shape = shape;
+    nodes.push_back(n);
+}
+
+static uint64_t Align(uint64_t offset)
+{
+    return (offset + TRIB_ALIGNMENT - 1) / TRIB_ALIGNMENT * TRIB_ALIGNMENT;
+}
+
+static bool WriteAt(FILE *fp, uint64_t offset, const void *data, size_t size)
+{
+    if(size == 0)
+        return true;
+    return fseek(fp, offset, SEEK_SET) == 0 && fwrite(data, size, 1, fp) == 1;
+}
+
+bool TribWriter::Write(const string& filename)
+{
+    TribHeader header;
+    memcpy(header.magic, TRIB_MAGIC, sizeof(header.magic));
+    header.version = TRIB_VERSION;
+    header.materialCount = materials.size();
+    header.shapeCount = shapes.size();
+    header.materialsOffset = sizeof(TribHeader);
+    header.shapesOffset = header.materialsOffset + sizeof(TribMaterial) * materials.size();
+    header.nodeCount = nodes.size();
+    header.pad = 0;
+    header.nodesOffset = header.shapesOffset + sizeof(TribShape) * shapes.size();
+
+    uint64_t offset = header.nodesOffset + sizeof(TribNode) * nodes.size();
+    for(Shape& s : shapes) {
+        s.info.verticesOffset = offset = Align(offset);
+        offset += sizeof(TribVertex) * s.vertices.size();
+        s.info.indicesOffset = offset = Align(offset);
+        offset += s.indices.size();
+    }
+
+    FILE *fp = fopen(filename.c_str(), "wb");
+    if(fp == NULL) {
+        fprintf(stderr, "couldn't open \"%s\" for writing\n", filename.c_str());
+        return false;
+    }
+
+    bool success = WriteAt(fp, 0, &header, sizeof(header)) &&
+        WriteAt(fp, header.materialsOffset, materials.data(), sizeof(TribMaterial) * materials.size()) &&
+        WriteAt(fp, header.nodesOffset, nodes.data(), sizeof(TribNode) * nodes.size());
+    for(size_t i = 0; success && i < shapes.size(); i++) {
+        const Shape& s = shapes[i];
+        success = WriteAt(fp, header.shapesOffset + sizeof(TribShape) * i, &s.info, sizeof(s.info)) &&
+            WriteAt(fp, s.info.verticesOffset, s.vertices.data(), sizeof(TribVertex) * s.vertices.size()) &&
+            WriteAt(fp, s.info.indicesOffset, s.indices.data(), s.indices.size());
+    }
+
+    if(fclose(fp) != 0 || !success) {
+        fprintf(stderr, "couldn't write \"%s\"\n", filename.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,123 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#ifndef _TRIB_H_
+#define _TRIB_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//
+// .trib, binary TriSrc: shapes already welded, optimized and split the
+// way TriSrcLoader makes them, laid out so a loader can map the file and
+// upload vertices and indices straight from it.  Offsets are in bytes
+// from the start of the file; vertex and index blocks start on
+// TRIB_ALIGNMENT boundaries.  Values are in the writer's byte order.
+//
+//     TribHeader
+//     TribMaterial[materialCount]
+//     TribShape[shapeCount]
+//     TribNode[nodeCount]
+//     per shape, TribVertex[vertexCount], then indices of indexSize bytes
+//
+// Nodes are listed depth first, each followed by its children.  Without
+// nodes the file is a Group of all its shapes.
+//
+const char TRIB_MAGIC[4] = {'T', 'R', 'I', 'B'};
+const uint32_t TRIB_VERSION = 2;
+const size_t TRIB_ALIGNMENT = 64;
+
+struct TribHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t materialCount;
+    uint32_t shapeCount;
+    uint64_t materialsOffset;
+    uint64_t shapesOffset;
+    uint32_t nodeCount;
+    uint32_t pad;
+    uint64_t nodesOffset;
+};
+
+struct TribMaterial
+{
+    char texture[256]; // absolute, relative to the file's directory, or "" for none
+    float diffuse[4];
+    float ambient[4];
+    float specular[4];
+    float shininess;
+    uint32_t pad[3];
+};
+
+// Same layout as TriSrc's vertices
+struct TribVertex
+{
+    float v[3];
+    float n[3];
+    float c[4];
+    float t[2];
+};
+
+struct TribShape
+{
+    uint32_t material;
+    uint32_t indexSize; // 2 if vertexCount allows, else 4
+    uint32_t vertexCount;
+    uint32_t indexCount; // GL_TRIANGLES
+    uint64_t verticesOffset;
+    uint64_t indicesOffset;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+struct TribNode
+{
+    float transform[16]; // of a group, as mat4f
+    int32_t shape; // index of the shape, or -1 for a group
+    uint32_t childCount; // nodes following that are children, if a group
+    uint32_t pad[2];
+};
+
+struct TribWriter
+{
+    std::vector<TribMaterial> materials;
+    std::vector<TribNode> nodes;
+
+    // Returns the material's index, or false if texture is too long
+    bool AddMaterial(const std::string& texture, const float diffuse[4], const float ambient[4], const float specular[4], float shininess, unsigned int& index);
+    // Returns the shape's index
+    unsigned int AddShape(unsigned int material, const TribVertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount);
+    unsigned int AddShape(unsigned int material, std::vector<TribVertex>&& vertices, const unsigned int *indices, size_t indexCount);
+    // Add nodes depth first; a group's children are the next childCount nodes
+    void AddGroup(const float transform[16], unsigned int childCount);
+    void AddShapeNode(unsigned int shape);
+    bool Write(const std::string& filename);
+
+private:
+    struct Shape
+    {
+        TribShape info;
+        std::vector<TribVertex> vertices;
+        std::vector<unsigned char> indices;
+    };
+    std::vector<Shape> shapes;
+};
+
+#endif /* _TRIB_H_ */
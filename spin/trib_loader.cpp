@@ -0,0 +1,220 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <libgen.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trib_loader.h"
+#include "trisrc_loader.h"
+#include "trib.h"
+#include "phongshader.h"
+#include "geometrypool.h"
+#include "compactvertex.h"
+
+#define GLFW_INCLUDE_GLCOREARB
+#include <GLFW/glfw3.h>
+
+using namespace std;
+
+namespace TribLoader
+{
+
+// Uploaded as they are, so TribVertex must be laid out as FloatVertex
+static_assert(sizeof(TribVertex) == sizeof(FloatVertex) &&
+    offsetof(TribVertex, n) == offsetof(FloatVertex, n) &&
+    offsetof(TribVertex, c) == offsetof(FloatVertex, c) &&
+    offsetof(TribVertex, t) == offsetof(FloatVertex, t), "TribVertex must match FloatVertex");
+
+static bool InFile(uint64_t offset, uint64_t size, size_t fileSize)
+{
+    return offset <= fileSize && size <= fileSize - offset;
+}
+
+// Indices come from disk and are uploaded as they are; one out of range
+// would have the GPU fetch past the shape's vertices
+static bool IndicesInRange(const void *indices, uint32_t indexSize, uint32_t indexCount, uint32_t vertexCount)
+{
+    uint32_t largest = 0;
+    if(indexSize == 2) {
+        const uint16_t *shortIndices = (const uint16_t *)indices;
+        for(uint32_t i = 0; i < indexCount; i++)
+            largest = max(largest, (uint32_t)shortIndices[i]);
+    } else {
+        const uint32_t *intIndices = (const uint32_t *)indices;
+        for(uint32_t i = 0; i < indexCount; i++)
+            largest = max(largest, intIndices[i]);
+    }
+    return indexCount == 0 || largest < vertexCount;
+}
+
+NodePtr MakeShape(PhongShader::MaterialPtr mtl, const unsigned char *file, const TribShape& s, bool textured)
+{
+    DrawListPtr drawlist(new DrawList);
+    drawlist->prims.push_back(DrawList::PrimInfo(GL_TRIANGLES, 0, s.indexCount));
+
+    box bounds;
+    bounds.extend(s.boundsMin[0], s.boundsMin[1], s.boundsMin[2]);
+    bounds.extend(s.boundsMax[0], s.boundsMax[1], s.boundsMax[2]);
+
+    const TribVertex *vertices = (const TribVertex *)(file + s.verticesOffset);
+    const void *indices = file + s.indicesOffset;
+    GLenum indexType = (s.indexSize == 2) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+    if(gCompactVertices) {
+        // Quantizing is per-vertex work the plain layout avoids
+        vector<unsigned int> wideIndices(s.indexCount);
+        for(size_t i = 0; i < s.indexCount; i++)
+            wideIndices[i] = (s.indexSize == 2) ? ((const uint16_t *)indices)[i] : ((const uint32_t *)indices)[i];
+        PlaceCompact(*drawlist, bounds, vertices[0].v, vertices[0].n, vertices[0].c, textured ? vertices[0].t : NULL, sizeof(TribVertex), s.vertexCount, wideIndices.data(), s.indexCount);
+    } else {
+        GeometryPool::Get(FloatVertexFormat()).Place(*drawlist, vertices, s.vertexCount, indices, indexType, s.indexCount);
+    }
+
+    DrawablePtr drawable(new PhongShadedGeometry(drawlist, mtl, bounds));
+    return ShapePtr(new Shape(drawable));
+}
+
+// Rebuild the subtree at nodes[index], advancing index past it
+static NodePtr MakeNode(const TribNode *nodes, uint32_t nodeCount, uint32_t& index, const vector<NodePtr>& shapes)
+{
+    const TribNode& n = nodes[index++];
+
+    if(n.shape >= 0)
+        return ((uint32_t)n.shape < shapes.size()) ? shapes[n.shape] : NodePtr();
+
+    if(n.childCount > nodeCount - index)
+        return NodePtr();
+
+    vector<NodePtr> children;
+    for(uint32_t i = 0; i < n.childCount; i++) {
+        if(index >= nodeCount)
+            return NodePtr();
+        NodePtr child = MakeNode(nodes, nodeCount, index, shapes);
+        if(!child)
+            return NodePtr();
+        children.push_back(child);
+    }
+
+    mat4f transform;
+    memcpy(transform.m_v, n.transform, sizeof(transform.m_v));
+    return GroupPtr(new Group(transform, children));
+}
+
+bool ReadTrib(const unsigned char *file, size_t size, const string& _dirname, NodePtr& root)
+{
+    const TribHeader *header = (const TribHeader *)file;
+    if(size < sizeof(TribHeader) || memcmp(header->magic, TRIB_MAGIC, sizeof(TRIB_MAGIC)) != 0) {
+        fprintf(stderr, "not a .trib file\n");
+        return false;
+    }
+    if(header->version != TRIB_VERSION) {
+        fprintf(stderr, ".trib version %u, expected %u\n", header->version, TRIB_VERSION);
+        return false;
+    }
+    if(!InFile(header->materialsOffset, (uint64_t)sizeof(TribMaterial) * header->materialCount, size) ||
+        !InFile(header->shapesOffset, (uint64_t)sizeof(TribShape) * header->shapeCount, size) ||
+        !InFile(header->nodesOffset, (uint64_t)sizeof(TribNode) * header->nodeCount, size)) {
+        fprintf(stderr, ".trib tables extend past end of file\n");
+        return false;
+    }
+
+    const TribMaterial *materials = (const TribMaterial *)(file + header->materialsOffset);
+    vector<PhongShader::MaterialPtr> mtls;
+    for(uint32_t i = 0; i < header->materialCount; i++) {
+        const TribMaterial& m = materials[i];
+        string texture(m.texture, strnlen(m.texture, sizeof(m.texture)));
+        if(texture.empty()) {
+            mtls.push_back(PhongShader::MaterialPtr(new PhongShader::Material(vec4f(m.diffuse), vec4f(m.ambient), vec4f(m.specular), m.shininess)));
+        } else {
+            if(texture[0] != '/')
+                texture = _dirname + "/" + texture;
+            GLuint t = TriSrcLoader::LoadTexture(texture);
+            mtls.push_back(PhongShader::MaterialPtr(new PhongShader::Material(vec4f(m.diffuse), t, vec4f(m.ambient), vec4f(m.specular), m.shininess)));
+        }
+    }
+
+    const TribShape *shapes = (const TribShape *)(file + header->shapesOffset);
+    vector<NodePtr> shapeNodes;
+    for(uint32_t i = 0; i < header->shapeCount; i++) {
+        const TribShape& s = shapes[i];
+        if(s.material >= header->materialCount || (s.indexSize != 2 && s.indexSize != 4) ||
+            s.vertexCount == 0 || s.indexCount % 3 != 0 ||
+            s.verticesOffset % sizeof(float) != 0 || s.indicesOffset % s.indexSize != 0 ||
+            !InFile(s.verticesOffset, (uint64_t)sizeof(TribVertex) * s.vertexCount, size) ||
+            !InFile(s.indicesOffset, (uint64_t)s.indexSize * s.indexCount, size) ||
+            !IndicesInRange(file + s.indicesOffset, s.indexSize, s.indexCount, s.vertexCount)) {
+            fprintf(stderr, ".trib shape %u is malformed\n", i);
+            return false;
+        }
+        shapeNodes.push_back(MakeShape(mtls[s.material], file, s, materials[s.material].texture[0] != '\0'));
+    }
+
+    if(header->nodeCount == 0) {
+        root = GroupPtr(new Group(mat4f::identity, shapeNodes));
+        return true;
+    }
+
+    uint32_t index = 0;
+    root = MakeNode((const TribNode *)(file + header->nodesOffset), header->nodeCount, index, shapeNodes);
+    if(!root) {
+        fprintf(stderr, ".trib nodes are malformed\n");
+        return false;
+    }
+
+    return true;
+}
+
+tuple<bool, NodePtr> Load(const string& filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+
+    if(fd == -1) {
+        fprintf(stderr, "couldn't open \"%s\" for reading\n", filename.c_str());
+        return make_tuple(false, NodePtr());
+    }
+
+    struct stat st;
+    void *file = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && st.st_size > 0)
+        file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(file == MAP_FAILED) {
+        fprintf(stderr, "couldn't map \"%s\"\n", filename.c_str());
+        return make_tuple(false, NodePtr());
+    }
+
+    char filename_copy[filename.size() + 1];
+    strncpy(filename_copy, filename.c_str(), filename.size() + 1);
+    string _dirname = string(dirname(filename_copy));
+
+    NodePtr root;
+    bool success = ReadTrib((const unsigned char *)file, st.st_size, _dirname, root);
+
+    // Vertices and indices were copied into GL buffers
+    munmap(file, st.st_size);
+
+    return make_tuple(success, root);
+}
+
+};
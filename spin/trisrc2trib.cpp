@@ -0,0 +1,34 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#include <cstdio>
+#include <cstdlib>
+#include "trisrc_loader.h"
+
+// Convert TriSrc text to .trib so spin can load it without parsing
+int main(int argc, char **argv)
+{
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s input.trisrc output.trib\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(!TriSrcLoader::ConvertToTrib(argv[1], argv[2]))
+        exit(EXIT_FAILURE);
+
+    exit(EXIT_SUCCESS);
+}
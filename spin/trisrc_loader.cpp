@@ -15,12 +15,31 @@
 // 
 
 #include <string>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
 #include <iostream>
 #include <map>
+#include <unordered_map>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <utility>
+#include <algorithm>
 #include <libgen.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <FreeImagePlus.h>
 #include "trisrc_loader.h"
 #include "phongshader.h"
+#include "geometrypool.h"
+#include "floatshape.h"
+#include "vertexweld.h"
+#include "trib.h"
+#include "meshcache.h"
 
 #define GLFW_INCLUDE_GLCOREARB
 #include <GLFW/glfw3.h>
@@ -110,117 +129,20 @@ GLuint LoadTexture(const string& filename)
     glBindTexture(GL_TEXTURE_2D, GL_NONE);
     CheckOpenGL(__FILE__, __LINE__);
 
+    if(gMeshRecorder)
+        gMeshRecorder->AddTexture(texture, filename);
+
     return texture;
 }
 
-struct Vertex
+struct Vertex : public FloatVertex
 {
-    float v[3];
-    float n[3];
-    float c[4];
-    float t[2];
     Vertex() {}
     Vertex(float v_[3], float n_[3], float c_[4], float t_[2]) :
-        v{v_[0], v_[1], v_[2]},
-        n{n_[0], n_[1], n_[2]},
-        c{c_[0], c_[1], c_[2], c_[3]},
-        t{t_[0], t_[1]}
+        FloatVertex{{v_[0], v_[1], v_[2]}, {n_[0], n_[1], n_[2]}, {c_[0], c_[1], c_[2], c_[3]}, {t_[0], t_[1]}}
     {}
 };
-
-struct VertexComparator
-{
-    bool operator()(const Vertex& v1, const Vertex& v2) const
-    {
-        for(int i = 0; i < 3; i++)
-            if(v1.v[i] < v2.v[i]) {
-                return true;
-            } else if(v1.v[i] > v2.v[i]) {
-                return false;
-            }
-        for(int i = 0; i < 3; i++)
-            if(v1.n[i] < v2.n[i]) {
-                return true;
-            } else if(v1.n[i] > v2.n[i]) {
-                return false;
-            }
-        for(int i = 0; i < 4; i++)
-            if(v1.c[i] < v2.c[i]) {
-                return true;
-            } else if(v1.c[i] > v2.c[i]) {
-                return false;
-            }
-        for(int i = 0; i < 2; i++)
-            if(v1.t[i] < v2.t[i]) {
-                return true;
-            } else if(v1.t[i] > v2.t[i]) {
-                return false;
-            }
-        return false;
-    }
-};
-
-
-NodePtr MakeShape(PhongShader::MaterialPtr mtl, Vertex *vertices, size_t vertexCount, unsigned int *indices, int indexCount, bool textured)
-{
-    PhongShaderPtr shader = PhongShader::GetForCurrentContext();
-
-    PhongShader::ProgramVariant& vt = textured ? shader->textured : shader->nontextured;
-    glUseProgram(vt.program);
-
-    DrawListPtr drawlist(new DrawList);
-    glGenVertexArrays(1, &drawlist->vertexArray);
-    glBindVertexArray(drawlist->vertexArray);
-    drawlist->indexed = false;
-    drawlist->prims.push_back(DrawList::PrimInfo(GL_TRIANGLES, 0, indexCount));
-    CheckOpenGL(__FILE__, __LINE__);
-
-    GLuint indexBuffer;
-    glGenBuffers(1, &indexBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indexCount, indices, GL_STATIC_DRAW);
-    CheckOpenGL(__FILE__, __LINE__);
-
-    GLuint vertexBuffer;
-    glGenBuffers(1, &vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertexCount, vertices, GL_STATIC_DRAW);
-    CheckOpenGL(__FILE__, __LINE__);
-
-    size_t coordSize = sizeof(float) * 3;
-    size_t normalSize = sizeof(float) * 3;
-    size_t colorSize = sizeof(float) * 4;
-    size_t texcoordSize = sizeof(float) * 2;
-
-    size_t stride = coordSize + normalSize + colorSize + texcoordSize;
-    size_t normalOffset = coordSize;
-    size_t colorOffset = normalOffset + normalSize;
-    size_t texcoordOffset = colorOffset + colorSize;
-
-    glVertexAttribPointer(vt.positionAttrib, 3, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(vt.positionAttrib);
-
-    glVertexAttribPointer(vt.normalAttrib, 3, GL_FLOAT, GL_FALSE, stride, (void*)normalOffset);
-    glEnableVertexAttribArray(vt.normalAttrib);
-
-    glVertexAttribPointer(vt.colorAttrib, 4, GL_FLOAT, GL_FALSE, stride, (void*)colorOffset);
-    glEnableVertexAttribArray(vt.colorAttrib);
-
-    if(textured) {
-        glVertexAttribPointer(vt.texcoordAttrib, 2, GL_FLOAT, GL_FALSE, stride, (void*)texcoordOffset);
-        glEnableVertexAttribArray(vt.texcoordAttrib);
-        CheckOpenGL(__FILE__, __LINE__);
-    }
-
-    glBindVertexArray(GL_NONE);
-
-    box bounds;
-    for(int i = 0; i < vertexCount; i++)
-        bounds.extend(vertices[i].v[0], vertices[i].v[1], vertices[i].v[2]);
-
-    DrawablePtr drawable(new PhongShadedGeometry(drawlist, mtl, bounds));
-    return ShapePtr(new Shape(drawable));
-}
+static_assert(sizeof(Vertex) == sizeof(FloatVertex), "Vertex arrays are passed as FloatVertex arrays");
 
 struct indexed_shape
 {
@@ -237,34 +159,153 @@ struct indexed_shape
     void add_triangle(const Vertex& v0, const Vertex& v1, const Vertex& v2)
     {
         for(auto v : {v0, v1, v2}) {
-	    auto vx = vertex_map.find(v);
-
-	    if(true /* vx == vertex_map.end() */) {
-		vertices.push_back(v);
-
-		int index = vertices.size() - 1;
-		vertex_map[v] = index;
-		indices.push_back(index);
+            unsigned int index = welder.Weld((const float *)&v);
+            if(index == vertices.size())
+                vertices.push_back(v);
+            indices.push_back(index);
+        }
+    }
 
-	    } else {
-		indices.push_back(vx->second);
-	    }
-	}
+    // Add other's triangles after this one's
+    void append(const indexed_shape& other)
+    {
+        vector<unsigned int> remap(other.vertices.size());
+        for(size_t i = 0; i < other.vertices.size(); i++) {
+            remap[i] = welder.Weld((const float *)&other.vertices[i]);
+            if(remap[i] == vertices.size())
+                vertices.push_back(other.vertices[i]);
+        }
+        for(unsigned int index : other.indices)
+            indices.push_back(remap[index]);
     }
 
-    map<Vertex, unsigned int, VertexComparator> vertex_map;      // only used during load
+    VertexWelder welder; // only used during load
 
     indexed_shape(const string& name_, const string& texture_name_, const vec4f& specular_, float shininess_) :
         name(name_),
         specular(specular_),
         shininess(shininess_),
-        texture_name(texture_name_)
+        texture_name(texture_name_),
+        welder(sizeof(Vertex) / sizeof(float), gWeldEpsilon)
     { }
 
 };
 
-typedef map<string, indexed_shape*> indexed_shape_dict;
 
+// TriSrc is parsed from memory with these rather than with stdio, which
+// is slow, follows the locale, and can't be split among threads.
+
+static bool IsSpace(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static const char *SkipSpace(const char *p, const char *end)
+{
+    while(p < end && IsSpace(*p))
+        p++;
+    return p;
+}
+
+static const char *TokenEnd(const char *p, const char *end)
+{
+    while(p < end && !IsSpace(*p))
+        p++;
+    return p;
+}
+
+// Parse a float at p as strtof would in the C locale, leaving p after
+// it.  Forms other than [sign]digits[.digits][e[sign]digits], such as
+// "inf", are left to strtod.
+static bool ParseFloat(const char *&p, const char *end, float& f)
+{
+    static const double powersOf10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    const uint64_t mantissaLimit = 100000000000000000ull; // digits past this only scale
+
+    p = SkipSpace(p, end);
+    const char *s = p;
+
+    bool negative = false;
+    if(s < end && (*s == '-' || *s == '+'))
+        negative = (*s++ == '-');
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    for(; s < end && *s >= '0' && *s <= '9'; s++, digits++) {
+        if(mantissa < mantissaLimit)
+            mantissa = mantissa * 10 + (*s - '0');
+        else
+            exponent++;
+    }
+    if(s < end && *s == '.') {
+        for(s++; s < end && *s >= '0' && *s <= '9'; s++, digits++) {
+            if(mantissa < mantissaLimit) {
+                mantissa = mantissa * 10 + (*s - '0');
+                exponent--;
+            }
+        }
+    }
+
+    bool simple = digits > 0;
+    if(simple && s < end && (*s == 'e' || *s == 'E')) {
+        s++;
+        bool negativeExponent = false;
+        if(s < end && (*s == '-' || *s == '+'))
+            negativeExponent = (*s++ == '-');
+        const char *first = s;
+        int e = 0;
+        for(; s < end && *s >= '0' && *s <= '9'; s++)
+            if(e < 10000)
+                e = e * 10 + (*s - '0');
+        simple = s > first;
+        exponent += negativeExponent ? -e : e;
+    }
+
+    if(!simple || (s < end && !IsSpace(*s))) {
+        char token[64];
+        const char *last = TokenEnd(p, end);
+        size_t length = last - p;
+        if(length == 0 || length >= sizeof(token))
+            return false;
+        memcpy(token, p, length);
+        token[length] = '\0';
+        char *tokenEnd;
+        f = strtod(token, &tokenEnd);
+        p = last;
+        return tokenEnd == token + length;
+    }
+
+    double value = mantissa;
+    if(exponent < 0)
+        value = (exponent >= -22) ? value / powersOf10[-exponent] : value * pow(10.0, exponent);
+    else if(exponent > 0)
+        value = (exponent <= 22) ? value * powersOf10[exponent] : value * pow(10.0, exponent);
+    f = negative ? -value : value;
+    p = s;
+    return true;
+}
+
+static bool ParseFloats(const char *&p, const char *end, float *f, int count)
+{
+    for(int i = 0; i < count; i++)
+        if(!ParseFloat(p, end, f[i]))
+            return false;
+    return true;
+}
+
+// Copy [first, last) into name[size] as a C string
+static bool CopyToken(const char *first, const char *last, char *name, size_t size)
+{
+    if((size_t)(last - first) >= size)
+        return false;
+    memcpy(name, first, last - first);
+    name[last - first] = '\0';
+    return true;
+}
 
 /*
 
@@ -276,35 +317,61 @@ TRIANGLE_SETS
     get(const char *name, const MATERIAL& material)
         add_triangle(const VERTEX& v0, const VERTEX& v1, const VERTEX& v2)
 
+Each triangle in the text is
+    "texture" tag specular[4] shininess {v[3] n[3] c[4] t[2]}[3]
+
 */
 
 template <class TRIANGLE_SETS, class MATERIAL, class VERTEX>
-bool ParseTriSrc(FILE *fp, TRIANGLE_SETS& sets)
+bool ParseTriSrc(const char *p, const char *end, TRIANGLE_SETS& sets)
 {
     char texture_name[512];
     char tag_name[512];
     float specular_color[4];
     float shininess;
 
-    while(fscanf(fp,"\"%[^\"]\"", texture_name) == 1) {
+    // Runs of triangles usually share a set; if a triangle's text before
+    // its vertices is the same as the last one's, so is its set
+    const char *previousHeader = NULL;
+    size_t previousHeaderLength = 0;
+    decltype(&sets.get_triangle_set(tag_name, declval<const MATERIAL&>())) previous = NULL;
+
+    for(p = SkipSpace(p, end); p < end; p = SkipSpace(p, end)) {
+        const char *header = p;
+
+        const char *texture_end = (*p == '"') ? (const char *)memchr(p + 1, '"', end - (p + 1)) : NULL;
+        if(texture_end == NULL || !CopyToken(p + 1, texture_end, texture_name, sizeof(texture_name))) {
+            fprintf(stderr, "couldn't read texture name\n");
+            return false;
+        }
         if(strcmp(texture_name, "*") == 0)
             texture_name[0] = '\0';
 
-	if(fscanf(fp,"%s ", tag_name) != 1) {
-	    fprintf(stderr, "couldn't read tag name\n");
-	    return false;
-	}
+        p = SkipSpace(texture_end + 1, end);
+        const char *tag_end = TokenEnd(p, end);
+        if(tag_end == p || !CopyToken(p, tag_end, tag_name, sizeof(tag_name))) {
+            fprintf(stderr, "couldn't read tag name\n");
+            return false;
+        }
+        p = tag_end;
+
+        if(!ParseFloats(p, end, specular_color, 4) || !ParseFloat(p, end, shininess)) {
+            fprintf(stderr, "couldn't read specular properties\n");
+            return false;
+        }
 
-	if(fscanf(fp,"%g %g %g %g %g ", &specular_color[0], &specular_color[1],
-	    &specular_color[2], &specular_color[3], &shininess) != 5) {
-	    fprintf(stderr, "couldn't read specular properties\n");
-	    return false;
-	}
+        if(shininess > 0 && shininess < 1) {
+            // shininess is not exponent - what is it?
+            shininess *= 10;
+        }
 
-	if(shininess > 0 && shininess < 1) {
-	    // shininess is not exponent - what is it?
-	    shininess *= 10;
-	}
+        size_t headerLength = p - header;
+        if(previous == NULL || headerLength != previousHeaderLength || memcmp(header, previousHeader, headerLength) != 0) {
+            MATERIAL mtl(texture_name, specular_color, shininess);
+            previous = &sets.get_triangle_set(tag_name, mtl);
+            previousHeader = header;
+            previousHeaderLength = headerLength;
+        }
 
         VERTEX verts[3];
         for(int i = 0; i < 3; i++) {
@@ -313,25 +380,30 @@ bool ParseTriSrc(FILE *fp, TRIANGLE_SETS& sets)
             float c[4];
             float t[2];
 
-	    if(fscanf(fp,"%g %g %g %g %g %g %g %g %g %g %g %g ",
-	        &v[0], &v[1], &v[2],
-	        &n[0], &n[1], &n[2],
-	        &c[0], &c[1], &c[2], &c[3],
-	        &t[0], &t[1]) != 12) {
+            if(!ParseFloats(p, end, v, 3) || !ParseFloats(p, end, n, 3) ||
+                !ParseFloats(p, end, c, 4) || !ParseFloats(p, end, t, 2)) {
 
-		fprintf(stderr, "couldn't read Vertex\n");
-		return false;
-	    }
+                fprintf(stderr, "couldn't read Vertex\n");
+                return false;
+            }
             verts[i] = VERTEX(v, n, c, t);
         }
 
-        MATERIAL mtl(texture_name, specular_color, shininess);
-
-        sets.get_triangle_set(tag_name, mtl).add_triangle(verts[0], verts[1], verts[2]);
+        previous->add_triangle(verts[0], verts[1], verts[2]);
     }
     return true;
 }
 
+// Start of the first triangle at or after p, taking a quote after
+// whitespace to open a texture name
+static const char *NextTriangle(const char *begin, const char *p, const char *end)
+{
+    for(; p < end; p++)
+        if(*p == '"' && (p == begin || IsSpace(p[-1])))
+            return p;
+    return end;
+}
+
 // XXX Temporary scaffolding to support parsing TriSets with old goop
 struct material
 {
@@ -345,6 +417,40 @@ struct material
     { }
 };
 
+// What distinguishes triangle sets, as parsed
+struct triangle_set_key
+{
+    material mtl;
+    string tag;
+
+    triangle_set_key(const material& mtl_, const char *tag_) :
+        mtl(mtl_),
+        tag(tag_)
+    { }
+
+    bool operator==(const triangle_set_key& other) const
+    {
+        return mtl.diffuse_texture_name == other.mtl.diffuse_texture_name &&
+            tag == other.tag &&
+            memcmp(mtl.specular, other.mtl.specular, sizeof(mtl.specular)) == 0 &&
+            mtl.shininess == other.mtl.shininess;
+    }
+};
+
+struct triangle_set_key_hash
+{
+    size_t operator()(const triangle_set_key& k) const
+    {
+        size_t h = hash<string>()(k.mtl.diffuse_texture_name) ^ (hash<string>()(k.tag) * 31);
+        uint32_t bits[5];
+        memcpy(bits, k.mtl.specular, sizeof(k.mtl.specular));
+        memcpy(&bits[4], &k.mtl.shininess, sizeof(k.mtl.shininess));
+        for(uint32_t b : bits)
+            h = h * 16777619u ^ b;
+        return h;
+    }
+};
+
 struct triangle_sets
 {
     string _dirname;
@@ -352,53 +458,104 @@ struct triangle_sets
         _dirname(dirname_)
     {}
 
-    indexed_shape_dict shapes;
-    indexed_shape& get_triangle_set(const char *name, const material& mtl)
-    {
-        char shape_name_cstr[512];
-        sprintf(shape_name_cstr, "%s.%s%.2f%.2f%.2f%.2f",
-            mtl.diffuse_texture_name.c_str(), name,
-            mtl.specular[0], mtl.specular[1], mtl.specular[2],
-            mtl.shininess);
-
-        string shape_name(shape_name_cstr);
+    // Sets by ID, in order of first use
+    vector<unique_ptr<indexed_shape>> shapes;
+    vector<triangle_set_key> keys;
+    unordered_map<triangle_set_key, unsigned int, triangle_set_key_hash> ids;
 
-        auto itr = shapes.find(shape_name);
-        indexed_shape *sh;
-
-        if (itr == shapes.end()) {
-
-            string absoluteTextureName;
-            if (mtl.diffuse_texture_name.empty())
-                absoluteTextureName = "";
-            else
-                absoluteTextureName = _dirname + "/" + string(mtl.diffuse_texture_name);
-
-            sh = new indexed_shape(name, absoluteTextureName, mtl.specular,
-                mtl.shininess);
-            shapes[shape_name] = sh;
-
-        } else {
+    unsigned int get_triangle_set_id(const triangle_set_key& key)
+    {
+        auto itr = ids.find(key);
+        if(itr != ids.end())
+            return itr->second;
+
+        string absoluteTextureName;
+        if (key.mtl.diffuse_texture_name.empty())
+            absoluteTextureName = "";
+        else
+            absoluteTextureName = _dirname + "/" + key.mtl.diffuse_texture_name;
+
+        unsigned int id = shapes.size();
+        shapes.push_back(unique_ptr<indexed_shape>(new indexed_shape(key.tag, absoluteTextureName,
+            key.mtl.specular, key.mtl.shininess)));
+        keys.push_back(key);
+        ids[key] = id;
+        return id;
+    }
 
-            sh = itr->second;
+    indexed_shape& get_triangle_set(const char *name, const material& mtl)
+    {
+        return *shapes[get_triangle_set_id(triangle_set_key(mtl, name))];
+    }
 
+    // Take other's sets, adding their triangles after those here
+    void merge(triangle_sets& other)
+    {
+        for(size_t i = 0; i < other.shapes.size(); i++) {
+            auto itr = ids.find(other.keys[i]);
+            if(itr == ids.end()) {
+                ids[other.keys[i]] = shapes.size();
+                shapes.push_back(move(other.shapes[i]));
+                keys.push_back(other.keys[i]);
+            } else {
+                shapes[itr->second]->append(*other.shapes[i]);
+            }
         }
-        return *sh;
+        other.shapes.clear();
+        other.keys.clear();
+        other.ids.clear();
     }
 };
 
+// Each thread parses at least this much of the file
+static const size_t MIN_THREAD_BYTES = 1024 * 1024;
+
+// Parse text into sets, split among threads at triangles and merged in order
+static bool ParseTriSrcText(const char *text, size_t size, triangle_sets& sets)
+{
+    const char *end = text + size;
+
+    size_t threadCount = max(1u, thread::hardware_concurrency());
+    threadCount = min(threadCount, size / MIN_THREAD_BYTES + 1);
+
+    vector<const char *> starts;
+    starts.push_back(text);
+    for(size_t i = 1; i < threadCount; i++)
+        starts.push_back(NextTriangle(text, max(starts.back(), text + size * i / threadCount), end));
+    starts.push_back(end);
+
+    vector<triangle_sets> pieces;
+    for(size_t i = 0; i < threadCount; i++)
+        pieces.push_back(triangle_sets(sets._dirname));
+    vector<char> succeeded(threadCount, false);
+    vector<thread> threads;
+    for(size_t i = 0; i < threadCount; i++)
+        threads.push_back(thread([&, i]() {
+            succeeded[i] = ParseTriSrc<triangle_sets, material, Vertex>(starts[i], starts[i + 1], pieces[i]);
+        }));
+    for(thread& t : threads)
+        t.join();
+
+    bool success = true;
+    for(size_t i = 0; i < threadCount; i++) {
+        success = success && succeeded[i];
+        sets.merge(pieces[i]);
+    }
+    return success;
+}
+
 // XXX let the thing this is calling do the de-indexing?
-bool ReadTriSrc(FILE *fp, string _dirname, vector<NodePtr>& nodes)
+bool ReadTriSrc(const char *text, size_t size, string _dirname, vector<NodePtr>& nodes)
 {
     triangle_sets sets(_dirname);
 
-    bool success = ParseTriSrc<triangle_sets, material, Vertex>(fp, sets);
+    bool success = ParseTriSrcText(text, size, sets);
 
     if(!success)
         return success;
 
-    for(auto named_shape : sets.shapes) {
-        indexed_shape *sh = named_shape.second;
+    for(auto& sh : sets.shapes) {
+        sh->welder.Release();
 
         static vec4f default_ambient(.1, .1, .1, 1);
         static vec4f default_diffuse(1, 1, 1, 1);
@@ -409,7 +566,7 @@ bool ReadTriSrc(FILE *fp, string _dirname, vector<NodePtr>& nodes)
 
             // XXX transparency
 
-            nodes.push_back(MakeShape(mtl, &sh->vertices[0], sh->vertices.size(), &sh->indices[0], sh->indices.size(), false));
+            nodes.push_back(MakeFloatShape(mtl, &sh->vertices[0], sh->vertices.size(), &sh->indices[0], sh->indices.size(), false));
 
         } else {
 
@@ -419,30 +576,69 @@ bool ReadTriSrc(FILE *fp, string _dirname, vector<NodePtr>& nodes)
 
             // XXX transparency
 
-            nodes.push_back(MakeShape(mtl, &sh->vertices[0], sh->vertices.size(), &sh->indices[0], sh->indices.size(), true));
+            nodes.push_back(MakeFloatShape(mtl, &sh->vertices[0], sh->vertices.size(), &sh->indices[0], sh->indices.size(), true));
         }
+
+        sh.reset();
     }
 
     return true;
 }
 
-tuple<bool, NodePtr> Load(const string& filename)
+// Map filename for reading; an empty file gives NULL and size 0
+static bool MapFile(const string& filename, const char *&text, size_t& size)
 {
-    FILE *fp = fopen(filename.c_str(), "r");
+    int fd = open(filename.c_str(), O_RDONLY);
 
-    if(fp == NULL) {
+    if(fd == -1) {
         fprintf(stderr, "couldn't open \"%s\" for reading\n", filename.c_str());
         return false;
     }
 
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+        fprintf(stderr, "couldn't get size of \"%s\"\n", filename.c_str());
+        close(fd);
+        return false;
+    }
+    size = st.st_size;
+
+    text = NULL;
+    if(size > 0) {
+        void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED) {
+            fprintf(stderr, "couldn't map \"%s\"\n", filename.c_str());
+            close(fd);
+            return false;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        text = (const char *)mapped;
+    }
+    close(fd);
+    return true;
+}
+
+static void UnmapFile(const char *text, size_t size)
+{
+    if(size > 0)
+        munmap((void *)text, size);
+}
+
+tuple<bool, NodePtr> Load(const string& filename)
+{
+    const char *text;
+    size_t size;
+    if(!MapFile(filename, text, size))
+        return make_tuple(false, NodePtr());
+
     char filename_copy[filename.size() + 1];
     strncpy(filename_copy, filename.c_str(), filename.size() + 1);
     string _dirname = string(dirname(filename_copy));
 
     vector<NodePtr> nodes;
-    bool success = ReadTriSrc(fp, _dirname, nodes);
+    bool success = ReadTriSrc(text, size, _dirname, nodes);
 
-    fclose(fp);
+    UnmapFile(text, size);
 
     if(!success)
         return make_tuple(success, GroupPtr());
@@ -452,5 +648,45 @@ tuple<bool, NodePtr> Load(const string& filename)
     return make_tuple(success, group);
 }
 
-};
+bool ConvertToTrib(const string& trisrcFilename, const string& tribFilename)
+{
+    static_assert(sizeof(Vertex) == sizeof(TribVertex), "TriSrc and .trib vertices must match");
+
+    const char *text;
+    size_t size;
+    if(!MapFile(trisrcFilename, text, size))
+        return false;
+
+    triangle_sets sets(".");
+    bool success = ParseTriSrcText(text, size, sets);
 
+    UnmapFile(text, size);
+
+    if(!success)
+        return success;
+
+    static const float default_ambient[4] = {.1, .1, .1, 1};
+    static const float default_diffuse[4] = {1, 1, 1, 1};
+
+    TribWriter writer;
+    for(size_t i = 0; i < sets.shapes.size(); i++) {
+        indexed_shape& sh = *sets.shapes[i];
+        sh.welder.Release();
+
+        // Texture names stay relative to the file
+        const material& mtl = sets.keys[i].mtl;
+        unsigned int m;
+        if(!writer.AddMaterial(mtl.diffuse_texture_name, default_diffuse, default_ambient, mtl.specular, mtl.shininess, m))
+            return false;
+        OptimizeFloatMesh(&sh.vertices[0], sh.vertices.size(), &sh.indices[0], sh.indices.size(),
+            [&](FloatVertex *vertices, size_t vertexCount, unsigned int *indices, size_t indexCount) {
+                writer.AddShape(m, (const TribVertex *)vertices, vertexCount, indices, indexCount);
+            });
+
+        sets.shapes[i].reset();
+    }
+
+    return writer.Write(tribFilename);
+}
+
+};
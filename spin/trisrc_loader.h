@@ -22,5 +22,11 @@ namespace TriSrcLoader
 
 std::tuple<bool, NodePtr> Load(const std::string& filename);
 
+// Write a TriSrc file's shapes, welded, split and optimized, as .trib
+bool ConvertToTrib(const std::string& trisrcFilename, const std::string& tribFilename);
+
+// Shared with TribLoader
+GLuint LoadTexture(const std::string& filename);
+
 };
 
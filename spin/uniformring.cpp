@@ -0,0 +1,86 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+#include "uniformring.h"
+#include "glstate.h"
+
+void CheckOpenGL(const char *filename, int line);
+
+UniformRing::UniformRing(size_t initialSegmentSize) :
+    buffer(0),
+    alignment(256),
+    segmentSize(initialSegmentSize),
+    segmentOffset(0),
+    segment(SEGMENTS - 1)
+{
+    for(int i = 0; i < SEGMENTS; i++)
+        fences[i] = 0;
+}
+
+unsigned char *UniformRing::Map(size_t size)
+{
+    if(buffer == 0) {
+        GLint a;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &a);
+        alignment = a;
+        segmentSize = Align(segmentSize);
+
+        glGenBuffers(1, &buffer);
+        gGLState.BindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, segmentSize * SEGMENTS, NULL, GL_STREAM_DRAW);
+    }
+
+    gGLState.BindBuffer(GL_UNIFORM_BUFFER, buffer);
+
+    if(size > segmentSize) {
+        // Orphan the old storage; the GPU keeps it until its draws finish
+        while(segmentSize < size)
+            segmentSize *= 2;
+        segmentSize = Align(segmentSize);
+        glBufferData(GL_UNIFORM_BUFFER, segmentSize * SEGMENTS, NULL, GL_STREAM_DRAW);
+        for(int i = 0; i < SEGMENTS; i++)
+            if(fences[i] != 0) {
+                glDeleteSync(fences[i]);
+                fences[i] = 0;
+            }
+    }
+
+    segment = (segment + 1) % SEGMENTS;
+    segmentOffset = segment * segmentSize;
+
+    if(fences[segment] != 0) {
+        glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(fences[segment]);
+        fences[segment] = 0;
+    }
+
+    void *p = glMapBufferRange(GL_UNIFORM_BUFFER, segmentOffset, size,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    CheckOpenGL(__FILE__, __LINE__);
+    return static_cast<unsigned char*>(p);
+}
+
+void UniformRing::Unmap()
+{
+    gGLState.BindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    CheckOpenGL(__FILE__, __LINE__);
+}
+
+void UniformRing::Fence()
+{
+    fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
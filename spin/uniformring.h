@@ -0,0 +1,60 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+#ifndef _UNIFORMRING_H_
+#define _UNIFORMRING_H_
+
+#include <cstddef>
+
+#define GLFW_INCLUDE_GLCOREARB
+#include <GLFW/glfw3.h>
+
+//
+// Uniform buffer written once per frame and read by that frame's draws.
+// The buffer is split into SEGMENTS; each frame maps the next segment
+// unsynchronized after waiting on the fence placed when that segment was
+// last drawn from, so the CPU never writes data the GPU is still reading.
+// A frame needing more than a segment grows the buffer.
+//
+struct UniformRing
+{
+    static const int SEGMENTS = 3;
+
+    GLuint buffer;
+    size_t alignment; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    size_t segmentSize;
+    size_t segmentOffset; // of the segment being written
+
+    // Round size up so records can be bound at multiples of it
+    size_t Align(size_t size) const { return (size + alignment - 1) / alignment * alignment; }
+
+    // Map size bytes at the start of the next segment
+    unsigned char *Map(size_t size);
+    void Unmap();
+    // Call after the frame's last draw reading this segment
+    void Fence();
+
+    UniformRing(size_t initialSegmentSize = 256 * 1024);
+
+private:
+    UniformRing(const UniformRing&);
+    UniformRing& operator=(const UniformRing&);
+
+    int segment;
+    GLsync fences[SEGMENTS];
+};
+
+#endif /* _UNIFORMRING_H_ */
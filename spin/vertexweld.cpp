@@ -0,0 +1,108 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#include <cstring>
+#include <cmath>
+#include "vertexweld.h"
+
+using namespace std;
+
+float gWeldEpsilon = 0;
+
+VertexWelder::VertexWelder(size_t floatsPerVertex, float epsilon_) :
+    floats(floatsPerVertex),
+    epsilon(epsilon_),
+    count(0),
+    table(1024, 0)
+{
+}
+
+// Cells within +-2^61 keep their top three bits all equal, so no cell
+// key can have these bits, which mark components compared exactly
+static const uint64_t EXACT_KEY = 0x4000000000000000ull;
+static const double MAX_CELL = 2305843009213693952.0; // 2^61
+
+void VertexWelder::MakeKey(const float *v, uint64_t *key) const
+{
+    for(size_t i = 0; i < floats; i++) {
+        double cell = (epsilon > 0) ? nearbyint((double)v[i] / epsilon) : NAN;
+        if(fabs(cell) <= MAX_CELL) { // false for NaN
+            key[i] = (uint64_t)(int64_t)cell;
+        } else {
+            float f = (v[i] == 0) ? 0 : v[i]; // -0 welds with 0
+            uint32_t bits;
+            memcpy(&bits, &f, sizeof(f));
+            key[i] = EXACT_KEY | bits;
+        }
+    }
+}
+
+// FNV-1a over the key's 32-bit halves
+uint32_t VertexWelder::Hash(const uint64_t *key, size_t length)
+{
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < length; i++) {
+        h ^= (uint32_t)key[i];
+        h *= 16777619u;
+        h ^= (uint32_t)(key[i] >> 32);
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+void VertexWelder::Grow()
+{
+    table.assign(table.size() * 2, 0);
+    size_t mask = table.size() - 1;
+    for(size_t v = 0; v < count; v++) {
+        size_t slot = Hash(&keys[v * floats], floats) & mask;
+        while(table[slot] != 0)
+            slot = (slot + 1) & mask;
+        table[slot] = v + 1;
+    }
+}
+
+unsigned int VertexWelder::Weld(const float *v)
+{
+    size_t first = keys.size();
+    keys.resize(first + floats);
+    uint64_t *key = &keys[first];
+    MakeKey(v, key);
+
+    size_t mask = table.size() - 1;
+    size_t slot = Hash(key, floats) & mask;
+    while(table[slot] != 0) {
+        unsigned int existing = table[slot] - 1;
+        if(memcmp(&keys[existing * floats], key, floats * sizeof(uint64_t)) == 0) {
+            keys.resize(first);
+            return existing;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    table[slot] = count + 1;
+    count++;
+    if(count * 2 > table.size())
+        Grow();
+    return count - 1;
+}
+
+void VertexWelder::Release()
+{
+    vector<uint64_t>().swap(keys);
+    vector<unsigned int>().swap(table);
+}
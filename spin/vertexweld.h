@@ -0,0 +1,62 @@
+//
+// Copyright 2013-2014, Bradley A. Grantham
+// 
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+// 
+//      http://www.apache.org/licenses/LICENSE-2.0
+// 
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+// 
+
+
+#ifndef _VERTEXWELD_H_
+#define _VERTEXWELD_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Loaders weld vertices with this epsilon (spin's -w option); 0 welds
+// only identical vertices
+extern float gWeldEpsilon;
+
+//
+// Hash table giving each distinct vertex, an array of floats, one index
+// in order of first appearance.  With epsilon > 0, components are
+// compared after rounding to the nearest multiple of epsilon, so that
+// vertices differing only by noise are shared.  Components too large for
+// that, or not finite, are compared exactly.  Welders share nothing,
+// so separate shapes can be welded on separate threads.
+//
+struct VertexWelder
+{
+    VertexWelder(size_t floatsPerVertex, float epsilon = 0);
+
+    // Index of the first vertex added equal to v; for a new vertex this
+    // is the count of distinct vertices added before it
+    unsigned int Weld(const float *v);
+
+    size_t size() const { return count; }
+
+    // Free the table when done welding
+    void Release();
+
+private:
+    size_t floats;
+    float epsilon;
+    size_t count;
+    std::vector<uint64_t> keys; // floats per distinct vertex
+    std::vector<unsigned int> table; // vertex + 1, or 0 if empty
+
+    void MakeKey(const float *v, uint64_t *key) const;
+    static uint32_t Hash(const uint64_t *key, size_t length);
+    void Grow();
+};
+
+#endif /* _VERTEXWELD_H_ */
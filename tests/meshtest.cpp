@@ -0,0 +1,124 @@
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <random>
+#include "meshoptimize.h"
+
+using namespace std;
+
+struct Vertex
+{
+    float v[3];
+    unsigned int id; // index before optimizing
+};
+
+typedef array<unsigned int, 3> Triangle;
+
+// Triangles by original vertex ids, each rotated to start at its lowest
+// id so winding is kept, sorted
+static vector<Triangle> triangles_of(const vector<Vertex>& vertices, const unsigned int *indices, size_t indexCount)
+{
+    vector<Triangle> triangles;
+    for(size_t i = 0; i < indexCount; i += 3) {
+        Triangle t = {{vertices[indices[i]].id, vertices[indices[i + 1]].id, vertices[indices[i + 2]].id}};
+        rotate(t.begin(), min_element(t.begin(), t.end()), t.end());
+        triangles.push_back(t);
+    }
+    sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+int main(int argc, char **argv)
+{
+    // FIFO of 4: a vertex hits until 4 misses come after its own
+    {
+        unsigned int hit[6] = {0, 1, 2, 3, 0, 1};
+        VertexCacheStatistics s = AnalyzeVertexCache(hit, 6, 4, 4);
+        assert(s.acmr == 2.0f); // 4 misses, 2 triangles
+        assert(s.atvr == 1.0f);
+
+        unsigned int evicted[6] = {0, 1, 2, 3, 4, 0};
+        s = AnalyzeVertexCache(evicted, 6, 5, 4);
+        assert(s.acmr == 3.0f); // 6 misses, 0 was pushed out by 4
+        assert(s.atvr == 6 / 5.0f);
+
+        unsigned int kept[6] = {0, 1, 2, 3, 4, 1};
+        s = AnalyzeVertexCache(kept, 6, 5, 4);
+        assert(s.acmr == 2.5f); // 5 misses, 1 is still the 4th newest
+        assert(s.atvr == 1.0f);
+    }
+
+    // OptimizeMesh on a shuffled grid keeps every triangle and its
+    // winding, and uses the cache better
+    {
+        const int size = 32;
+        vector<Vertex> vertices;
+        for(int y = 0; y <= size; y++)
+            for(int x = 0; x <= size; x++) {
+                Vertex v = {{(float)x, (float)y, 0}, (unsigned int)vertices.size()};
+                vertices.push_back(v);
+            }
+        vector<unsigned int> indices;
+        for(int y = 0; y < size; y++)
+            for(int x = 0; x < size; x++) {
+                unsigned int i = y * (size + 1) + x;
+                unsigned int quad[6] = {i, i + 1, i + size + 2, i, i + size + 2, i + size + 1};
+                indices.insert(indices.end(), quad, quad + 6);
+            }
+        vector<Triangle> expected = triangles_of(vertices, indices.data(), indices.size());
+
+        minstd_rand random(1);
+        vector<unsigned int> permutation(vertices.size());
+        for(size_t i = 0; i < permutation.size(); i++)
+            permutation[i] = i;
+        shuffle(permutation.begin(), permutation.end(), random);
+        vector<Vertex> shuffled(vertices.size());
+        for(size_t i = 0; i < vertices.size(); i++)
+            shuffled[permutation[i]] = vertices[i];
+        for(unsigned int& i : indices)
+            i = permutation[i];
+        vector<Triangle> order(indices.size() / 3);
+        for(size_t t = 0; t < order.size(); t++)
+            order[t] = {{indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2]}};
+        shuffle(order.begin(), order.end(), random);
+        for(size_t t = 0; t < order.size(); t++)
+            copy(order[t].begin(), order[t].end(), &indices[t * 3]);
+        assert(triangles_of(shuffled, indices.data(), indices.size()) == expected);
+
+        float before = AnalyzeVertexCache(indices.data(), indices.size(), shuffled.size()).acmr;
+        size_t vertexCount = OptimizeMesh(shuffled.data(), sizeof(Vertex), offsetof(Vertex, v), shuffled.size(), indices.data(), indices.size());
+        assert(vertexCount == vertices.size());
+        shuffled.resize(vertexCount);
+        assert(triangles_of(shuffled, indices.data(), indices.size()) == expected);
+        float after = AnalyzeVertexCache(indices.data(), indices.size(), vertexCount).acmr;
+        assert(after < before);
+        assert(after < 1.0f);
+    }
+
+    // OptimizeVertexFetch moves vertices into first-use order in place
+    // and drops those no index uses
+    {
+        vector<Vertex> vertices;
+        for(unsigned int i = 0; i < 8; i++) {
+            Vertex v = {{(float)i, 0, 0}, i};
+            vertices.push_back(v);
+        }
+        unsigned int indices[9] = {5, 2, 7, 7, 2, 0, 0, 3, 5}; // 1, 4, 6 unused
+        vector<Vertex> original = vertices;
+        vector<Triangle> expected = triangles_of(vertices, indices, 9);
+
+        size_t vertexCount = OptimizeVertexFetch(vertices.data(), sizeof(Vertex), vertices.size(), indices, 9);
+        assert(vertexCount == 5);
+        unsigned int firstUse[5] = {5, 2, 7, 0, 3};
+        for(size_t i = 0; i < vertexCount; i++) {
+            assert(vertices[i].id == firstUse[i]);
+            assert(vertices[i].v[0] == original[firstUse[i]].v[0]);
+        }
+        unsigned int rewritten[9] = {0, 1, 2, 2, 1, 3, 3, 4, 0};
+        assert(equal(indices, indices + 9, rewritten));
+        vertices.resize(vertexCount);
+        assert(triangles_of(vertices, indices, 9) == expected);
+    }
+}
@@ -1,5 +1,29 @@
 #include <cassert>
+#include <cstdlib>
 #include "vectormath.h"
+#include "geometry.h"
+
+static float frand()
+{
+    return rand() / (float)RAND_MAX * 2.0f - 1.0f;
+}
+
+static mat4f random_matrix()
+{
+    mat4f m;
+    for(int i = 0; i < 16; i++)
+        m[i] = frand();
+    return m;
+}
+
+template <class V>
+static bool nearly_equal(const V& v0, const V& v1, float epsilon = 1e-5f)
+{
+    for(int i = 0; i < V::dimension(); i++)
+        if(fabsf(v0[i] - v1[i]) > epsilon)
+            return false;
+    return true;
+}
 
 int main(int argc, char **argv)
 {
@@ -10,4 +34,191 @@ int main(int argc, char **argv)
 
     vec3f d = a - b;
     assert(d == vec3f(1, -1, 0));
+
+    // SIMD products must match the scalar reference
+    for(int i = 0; i < 100; i++) {
+        mat4f m1 = random_matrix();
+        mat4f m2 = random_matrix();
+        vec4f v4(frand(), frand(), frand(), frand());
+        vec3f v3(frand(), frand(), frand());
+
+        assert(nearly_equal(m1 * m2, mat4f_mult_scalar(m1, m2)));
+        assert(nearly_equal(v4 * m1, vec4f_mult_scalar(v4, m1)));
+        assert(nearly_equal(v3 * m1, vec3f_mult_scalar(v3, m1)));
+    }
+
+    // Batch transforms must match one-at-a-time transforms
+    {
+        struct Vertex { float v[3]; float n[3]; float c[4]; float t[2]; };
+        const int count = 37;
+        Vertex verts[count];
+        float x[count], y[count], z[count];
+        float ox[count], oy[count], oz[count];
+        float out[count * 3];
+        mat4f m = random_matrix();
+
+        box expected;
+        for(int i = 0; i < count; i++) {
+            for(int j = 0; j < 3; j++)
+                verts[i].v[j] = frand();
+            x[i] = verts[i].v[0];
+            y[i] = verts[i].v[1];
+            z[i] = verts[i].v[2];
+            expected.extend(vec3f(verts[i].v) * m);
+        }
+
+        transform_points(m, verts[0].v, sizeof(Vertex), out, sizeof(float) * 3, count);
+        transform_points_soa(m, x, y, z, ox, oy, oz, count);
+        for(int i = 0; i < count; i++) {
+            vec3f p = vec3f(verts[i].v) * m;
+            assert(nearly_equal(vec3f(out + i * 3), p));
+            assert(nearly_equal(vec3f(ox[i], oy[i], oz[i]), p));
+        }
+
+        transform_directions(m, verts[0].v, sizeof(Vertex), out, sizeof(float) * 3, count);
+        transform_directions_soa(m, x, y, z, ox, oy, oz, count);
+        for(int i = 0; i < count; i++) {
+            vec4f p = vec4f(x[i], y[i], z[i], 0) * m;
+            assert(nearly_equal(vec3f(out + i * 3), vec3f(p.m_v)));
+            assert(nearly_equal(vec3f(ox[i], oy[i], oz[i]), vec3f(p.m_v)));
+        }
+
+        box b = transformed_bounds(verts[0].v, sizeof(Vertex), count, m);
+        assert(nearly_equal(b.m_min, expected.m_min));
+        assert(nearly_equal(b.m_max, expected.m_max));
+
+        // in-place
+        transform_points(m, verts[0].v, sizeof(Vertex), verts[0].v, sizeof(Vertex), count);
+        box inplace;
+        inplace.extend(verts[0].v, sizeof(Vertex), count);
+        assert(nearly_equal(inplace.m_min, expected.m_min));
+        assert(nearly_equal(inplace.m_max, expected.m_max));
+    }
+
+    // Specialized inverses must agree with the general inverse
+    {
+        mat4f rigid = mat4f::rotation(.7, 0, .6, .8) * mat4f::translation(1, 2, 3);
+        mat4f uniform = mat4f::scale(2, 2, 2) * rigid;
+        mat4f affine = mat4f::scale(1, 3, .5) * rigid;
+        mat4f general = rigid;
+        general[3] = .25;
+
+        assert(rigid.classify() == mat4f::RIGID);
+        assert(uniform.classify() == mat4f::UNIFORM_SCALE);
+        assert(affine.classify() == mat4f::AFFINE);
+        assert(general.classify() == mat4f::GENERAL);
+
+        for(const mat4f& m : {rigid, uniform, affine, general}) {
+            mat4f fast, reference;
+            assert(fast.invert(m));
+            assert(reference.invert_general(m));
+            assert(nearly_equal(fast, reference, 1e-4f));
+            assert(nearly_equal(m * fast, mat4f::identity, 1e-4f));
+
+            // normal_matrix() only looks at the upper 3x3
+            if(m.classify() == mat4f::GENERAL)
+                continue;
+
+            mat4f normal = m;
+            normal.transpose();
+            normal.invert_general(normal);
+            mat4f n = m.normal_matrix();
+            for(int i = 0; i < 3; i++)
+                for(int j = 0; j < 3; j++)
+                    assert(fabsf(n[i * 4 + j] - normal[i * 4 + j]) < 1e-4f);
+        }
+
+        mat4f singular = mat4f::scale(1, 0, 1);
+        mat4f out;
+        assert(!out.invert(singular));
+    }
+
+    // Quaternion composition must match matrix composition
+    {
+        rot4f r1(.5, 1, 0, 0), r2(1.2, 0, .6, .8);
+        quatf q1(r1), q2(r2);
+
+        assert(nearly_equal(mat4f(q1), mat4f(r1)));
+        assert(nearly_equal(mat4f(q1 * q2), mat4f(r1) * mat4f(r2)));
+        assert(nearly_equal(mat4f(r1 * r2), mat4f(r1) * mat4f(r2)));
+
+        assert(nearly_equal(quat_slerp(q1, q2, 0), q1));
+        assert(nearly_equal(quat_slerp(q1, q2, 1), q2));
+        quatf half = quat_slerp(quatf(), quatf::axis_angle(1, 0, 0, 1), .5);
+        assert(nearly_equal(half, quatf::axis_angle(.5, 0, 0, 1)));
+    }
+
+    // Transformed boxes must exactly bound all eight transformed corners
+    {
+        box b;
+        b.extend(vec3f(-1, -2, -3));
+        b.extend(vec3f(4, 5, 6));
+        mat4f m = mat4f::rotation(.7, 0, .6, .8) * mat4f::scale(2, 1, .5) * mat4f::translation(1, 2, 3);
+
+        box corners;
+        for(int i = 0; i < 8; i++) {
+            vec3f corner(
+                (i & 1) ? b.m_max[0] : b.m_min[0],
+                (i & 2) ? b.m_max[1] : b.m_min[1],
+                (i & 4) ? b.m_max[2] : b.m_min[2]);
+            corners.extend(corner * m);
+        }
+
+        box tb = b * m;
+        assert(nearly_equal(tb.m_min, corners.m_min, 1e-4f));
+        assert(nearly_equal(tb.m_max, corners.m_max, 1e-4f));
+
+        assert((box() * m).is_empty());
+        box e;
+        e.extend(box());
+        assert(e.is_empty());
+    }
+
+    // Frustum planes from a projection classify boxes in eye space
+    {
+        vec4f planes[6];
+        make_clip_planes(mat4f::frustum(-1, 1, -1, 1, 1, 100), planes);
+
+        box inside, outside, straddle;
+        inside.extend(vec3f(-.1, -.1, -10));
+        inside.extend(vec3f(.1, .1, -9));
+        outside.extend(vec3f(-.1, -.1, 5));
+        outside.extend(vec3f(.1, .1, 6));
+        straddle.extend(vec3f(-.1, -.1, -2));
+        straddle.extend(vec3f(.1, .1, 0));
+
+        for(int i = 0; i < 6; i++)
+            assert(box_plane_side(inside, planes[i]) == 1);
+        assert(box_plane_side(outside, planes[4]) == -1);
+        assert(box_plane_side(straddle, planes[4]) == 0);
+    }
+
+    // Octahedral normals survive quantization to snorm16
+    for(int i = 0; i < 1000; i++) {
+        vec3f n = vec_normalize(vec3f(frand(), frand(), frand()));
+        vec2f e = oct_encode(n);
+        assert(fabsf(e[0]) <= 1 && fabsf(e[1]) <= 1);
+        assert(nearly_equal(oct_decode(e), n, 1e-5f));
+        vec2f q(roundf(e[0] * 32767) / 32767, roundf(e[1] * 32767) / 32767);
+        assert(vec_dot(oct_decode(q), n) > .99999f);
+    }
+    assert(nearly_equal(oct_decode(oct_encode(vec3f(0, 0, -1))), vec3f(0, 0, -1)));
+
+    // Half floats round to nearest and cover the subnormal range
+    assert(float_to_half(1.0f) == 0x3c00);
+    assert(float_to_half(-2.0f) == 0xc000);
+    assert(float_to_half(65504.0f) == 0x7bff);
+    assert(float_to_half(1e6f) == 0x7c00);
+    assert(float_to_half(5.9604645e-8f) == 0x0001);
+    assert(half_to_float(0x0001) == 5.9604645e-8f);
+    for(int h = 0; h < 0x7c00; h++)
+        assert(float_to_half(half_to_float(h)) == h);
+    for(int i = 0; i < 1000; i++) {
+        float f = frand() * 100;
+        assert(fabsf(half_to_float(float_to_half(f)) - f) <= fabsf(f) / 2048);
+    }
+
+    mat4f t = mat4f::translation(1, 2, 3);
+    assert(vec3f(1, 1, 1) * t == vec3f(2, 3, 4));
+    assert(nearly_equal(t * mat4f::identity, t, 0));
 }
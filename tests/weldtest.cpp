@@ -0,0 +1,70 @@
+#include <cassert>
+#include <cmath>
+#include "vertexweld.h"
+
+int main(int argc, char **argv)
+{
+    // -0 welds with 0, exactly and with an epsilon
+    for(float epsilon : {0.0f, 1e-3f}) {
+        VertexWelder welder(3, epsilon);
+        float a[3] = {0, 1, 2}, b[3] = {-0.0f, 1, 2};
+        assert(welder.Weld(a) == 0);
+        assert(welder.Weld(b) == 0);
+        assert(welder.size() == 1);
+    }
+
+    // Without an epsilon only identical vertices weld
+    {
+        VertexWelder welder(3);
+        float a[3] = {1, 2, 3}, b[3] = {1, 2, 3.0000002f};
+        assert(welder.Weld(a) == 0);
+        assert(welder.Weld(b) == 1);
+        assert(welder.Weld(a) == 0);
+    }
+
+    // Within epsilon welds, a cell or more apart doesn't
+    {
+        VertexWelder welder(3, 1e-3f);
+        float a[3] = {1, 2, 3}, b[3] = {1.0001f, 2, 2.9999f}, c[3] = {1.002f, 2, 3};
+        assert(welder.Weld(a) == 0);
+        assert(welder.Weld(b) == 0);
+        assert(welder.Weld(c) == 1);
+    }
+
+    // Cells 2^32 apart must not share a key
+    {
+        VertexWelder welder(3, 1e-6f);
+        float a[3] = {0, 0, 0}, b[3] = {4294.967296f, 0, 0};
+        assert(welder.Weld(a) == 0);
+        assert(welder.Weld(b) == 1);
+    }
+
+    // Values beyond the cell range, or not finite, are compared exactly
+    {
+        VertexWelder welder(1, 1e-30f);
+        float a[1] = {1e30f}, b[1] = {1.0000001e30f}, c[1] = {-1e30f};
+        float inf[1] = {INFINITY}, nan[1] = {NAN};
+        assert(welder.Weld(a) == 0);
+        assert(welder.Weld(b) == 1);
+        assert(welder.Weld(c) == 2);
+        assert(welder.Weld(inf) == 3);
+        assert(welder.Weld(nan) == 4);
+        assert(welder.Weld(inf) == 3);
+        assert(welder.Weld(a) == 0);
+    }
+
+    // Indices survive the table growing well past its first 1024 slots
+    {
+        VertexWelder welder(3, 1e-3f);
+        const int count = 5000;
+        for(int i = 0; i < count; i++) {
+            float v[3] = {(float)(i % 17), (float)(i / 17), .5f};
+            assert(welder.Weld(v) == (unsigned int)i);
+        }
+        for(int i = 0; i < count; i++) {
+            float v[3] = {(float)(i % 17) + 1e-4f, (float)(i / 17), .5f};
+            assert(welder.Weld(v) == (unsigned int)i);
+        }
+        assert(welder.size() == count);
+    }
+}